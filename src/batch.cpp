@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "batch.h"
+#include "libbf.h"
+#include "runtime.h"
+
+static bool ReadFile(const std::string& path, std::string* data) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    return false;
+  }
+  data->assign(std::istreambuf_iterator<char>(file),
+               std::istreambuf_iterator<char>());
+  return true;
+}
+
+static bool ReadDirectory(const std::string& path,
+                          std::vector<BatchInput>* inputs,
+                          std::string* error) {
+  DIR* dir = opendir(path.c_str());
+  if (!dir) {
+    *error = "Can't open directory " + path;
+    return false;
+  }
+  std::vector<std::string> names;
+  while (struct dirent* entry = readdir(dir)) {
+    std::string file_path = path + "/" + entry->d_name;
+    struct stat st;
+    if (stat(file_path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(dir);
+
+  std::sort(names.begin(), names.end());
+  for (auto& name : names) {
+    BatchInput input;
+    input.name = name;
+    if (!ReadFile(path + "/" + name, &input.data)) {
+      *error = "Can't read " + path + "/" + name;
+      return false;
+    }
+    inputs->push_back(std::move(input));
+  }
+  return true;
+}
+
+static void SplitStream(std::istream& stream, std::vector<BatchInput>* inputs) {
+  std::string record;
+  int index = 0;
+  while (std::getline(stream, record, '\0')) {
+    BatchInput input;
+    input.name = std::to_string(index++);
+    input.data = std::move(record);
+    inputs->push_back(std::move(input));
+  }
+}
+
+bool ReadBatchInputs(const std::string& path, std::vector<BatchInput>* inputs,
+                     std::string* error) {
+  if (path == "-") {
+    SplitStream(std::cin, inputs);
+    return true;
+  }
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    *error = "Can't find " + path;
+    return false;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    return ReadDirectory(path, inputs, error);
+  }
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    *error = "Can't read " + path;
+    return false;
+  }
+  SplitStream(file, inputs);
+  return true;
+}
+
+static void AppendOutput(void* user, const char* data, size_t len) {
+  static_cast<std::string*>(user)->append(data, len);
+}
+
+static void RunWorker(BFProgram* program,
+                      const std::vector<BatchInput>& inputs,
+                      std::vector<BatchResult>* results,
+                      std::atomic<size_t>* next, uint64_t max_steps,
+                      double max_seconds) {
+  std::vector<char> tape(program->GetStoreSize());
+  char output[1 << 16];
+
+  for (size_t i = (*next)++; i < inputs.size(); i = (*next)++) {
+    const BatchInput& input = inputs[i];
+    BatchResult& result = (*results)[i];
+    std::fill(tape.begin(), tape.end(), 0);
+
+    BFContext ctx;
+    InitContext(&ctx, tape.data(), tape.size(), input.data.data(),
+                input.data.size(), output, sizeof(output), AppendOutput,
+                &result.output);
+    SetBudget(&ctx, max_steps, max_seconds);
+
+    auto start = std::chrono::steady_clock::now();
+    result.status = BFRunContext(program, &ctx);
+    FlushContext(&ctx);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    result.seconds = elapsed.count();
+  }
+}
+
+std::vector<BatchResult> RunBatch(BFProgram* program,
+                                  const std::vector<BatchInput>& inputs,
+                                  unsigned workers, uint64_t max_steps,
+                                  double max_seconds) {
+  std::vector<BatchResult> results(inputs.size());
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> threads;
+  workers = std::max(1u, std::min<unsigned>(workers, inputs.size()));
+
+  for (unsigned i = 0; i < workers; i++) {
+    threads.emplace_back(RunWorker, program, std::cref(inputs), &results,
+                         &next, max_steps, max_seconds);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return results;
+}
@@ -0,0 +1,37 @@
+#ifndef BATCH
+#define BATCH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "libbf.h"
+
+struct BatchInput {
+  std::string name;
+  std::string data;
+};
+
+struct BatchResult {
+  std::string output;
+  BFStatus status;
+  // Wall-clock time spent in the program
+  double seconds;
+};
+
+// Reads inputs from path
+// A directory gives one input per regular file, ordered by name; any other
+// file (or "-" for stdin) is split into inputs at NUL bytes
+// Returns false and sets error if path can't be read
+bool ReadBatchInputs(const std::string& path, std::vector<BatchInput>* inputs,
+                     std::string* error);
+
+// Runs program once per input on a pool of workers
+// Each worker owns a tape and output buffer; results are in input order
+// Each run gets its own budget, see SetBudget in runtime.h
+std::vector<BatchResult> RunBatch(BFProgram* program,
+                                  const std::vector<BatchInput>& inputs,
+                                  unsigned workers, uint64_t max_steps,
+                                  double max_seconds = 0);
+
+#endif  // BATCH
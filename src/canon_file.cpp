@@ -0,0 +1,407 @@
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "canon_file.h"
+#include "canon_ir.h"
+#include "cell_access.h"
+#include "compact_ir.h"
+
+// Version 2 added set_range and move_range, version 3 div_mod_cell
+static const uint32_t kCanonFileVersion = 3;
+static const char kBinaryMagic[] = "BFIR";
+static const size_t kBinaryMagicSize = 4;
+static const char* kTextHeader = "bf-canon-ir";
+
+struct OpFormat {
+  const char* name;
+  bool is_block;
+  // Not counting the end of a block
+  int operands;
+};
+
+// Indexed by CompactOp
+static const OpFormat kOpFormats[] = {
+    {"ptr_mov", false, 1}, {"add", false, 2},
+    {"mul", false, 3},     {"set", false, 2},
+    {"input", false, 1},   {"output", false, 1},
+    {"loop", true, 0},     {"if", true, 0},
+    {"counted_loop", true, 1}, {"div_mod", true, 4},
+    {"set_range", false, 3},   {"move_range", false, 3},
+    {"div_mod_cell", true, 5}};
+static const int kOpCount = sizeof(kOpFormats) / sizeof(kOpFormats[0]);
+static const int kMaxOperands = 5;
+static const int kCellModulus = 256;
+
+static int Wrap(int amt) {
+  return ((amt % kCellModulus) + kCellModulus) % kCellModulus;
+}
+
+// Operands as the CNode constructors take them
+static void GetOperands(const CompactProgram& program, size_t i,
+                        int32_t* operands) {
+  switch (program.GetOp(i)) {
+    case COP_PTR_MOV:
+    case COP_INPUT:
+    case COP_OUTPUT:
+      operands[0] = program.GetA(i);
+      break;
+    case COP_ADD:
+    case COP_SET:
+      operands[0] = program.GetA(i);
+      operands[1] = program.GetB(i);
+      break;
+    case COP_MUL:
+    case COP_SET_RANGE:
+    case COP_MOVE_RANGE:
+      operands[0] = program.GetA(i);
+      operands[1] = program.GetExtra(i)[0];
+      operands[2] = program.GetExtra(i)[1];
+      break;
+    case COP_LOOP:
+    case COP_IF:
+      break;
+    case COP_COUNTED_LOOP:
+      operands[0] = program.GetB(i);
+      break;
+    case COP_DIV_MOD:
+      for (int j = 0; j < 4; j++) {
+        operands[j] = program.GetExtra(i)[j];
+      }
+      break;
+    case COP_DIV_MOD_CELL:
+      for (int j = 0; j < 5; j++) {
+        operands[j] = program.GetExtra(i)[j];
+      }
+      break;
+  }
+}
+
+// Returns false if the operands can't make a valid node
+static bool AppendInstruction(CompactProgram* program, CompactOp op,
+                              int32_t end, const int32_t* operands) {
+  switch (op) {
+    case COP_PTR_MOV:
+    case COP_INPUT:
+    case COP_OUTPUT:
+      program->Append(op, operands[0]);
+      break;
+    case COP_ADD:
+    case COP_SET:
+      program->Append(op, operands[0], operands[1]);
+      break;
+    case COP_MUL:
+      program->AppendWithExtra(op, operands[0], {operands[1], operands[2]});
+      break;
+    case COP_LOOP:
+    case COP_IF:
+      program->Append(op, end);
+      break;
+    case COP_COUNTED_LOOP:
+      // A step of 0 never reaches zero, which the trip count can't say
+      if (Wrap(operands[0]) == 0) {
+        return false;
+      }
+      program->Append(op, end, Wrap(operands[0]));
+      break;
+    case COP_DIV_MOD:
+      if (operands[0] < 2 || operands[0] >= kCellModulus) {
+        return false;
+      }
+      program->AppendWithExtra(
+          op, end, {operands[0], operands[1], operands[2], operands[3]});
+      break;
+    case COP_DIV_MOD_CELL:
+      program->AppendWithExtra(op, end, {operands[0], operands[1], operands[2],
+                                         operands[3], operands[4]});
+      break;
+    case COP_SET_RANGE:
+    case COP_MOVE_RANGE:
+      if (operands[1] <= 0) {
+        return false;
+      }
+      program->AppendWithExtra(op, operands[0], {operands[1], operands[2]});
+      break;
+  }
+  return true;
+}
+
+static void WriteWord(std::ostream& out, uint32_t word) {
+  char bytes[4];
+  for (int i = 0; i < 4; i++) {
+    bytes[i] = (word >> (8 * i)) & 0xff;
+  }
+  out.write(bytes, 4);
+}
+
+static bool ReadWord(std::istream& in, uint32_t* word) {
+  unsigned char bytes[4];
+  if (!in.read(reinterpret_cast<char*>(bytes), 4)) {
+    return false;
+  }
+  *word = bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+  return true;
+}
+
+static void WriteBinary(const CompactProgram& program, std::ostream& out) {
+  out.write(kBinaryMagic, kBinaryMagicSize);
+  WriteWord(out, kCanonFileVersion);
+  WriteWord(out, program.Size());
+  for (size_t i = 0; i < program.Size(); i++) {
+    CompactOp op = program.GetOp(i);
+    out.put(op);
+    if (kOpFormats[op].is_block) {
+      WriteWord(out, program.GetA(i));
+    }
+    int32_t operands[kMaxOperands];
+    GetOperands(program, i, operands);
+    for (int j = 0; j < kOpFormats[op].operands; j++) {
+      WriteWord(out, operands[j]);
+    }
+  }
+}
+
+static void WriteText(const CompactProgram& program, std::ostream& out) {
+  out << kTextHeader << " " << kCanonFileVersion << std::endl;
+  // Ends of the open blocks, innermost last
+  std::vector<size_t> ends;
+  for (size_t i = 0; i <= program.Size(); i++) {
+    while (!ends.empty() && ends.back() == i) {
+      ends.pop_back();
+      out << std::string(2 * ends.size(), ' ') << "end" << std::endl;
+    }
+    if (i == program.Size()) {
+      break;
+    }
+
+    CompactOp op = program.GetOp(i);
+    out << std::string(2 * ends.size(), ' ') << kOpFormats[op].name;
+    int32_t operands[kMaxOperands];
+    GetOperands(program, i, operands);
+    for (int j = 0; j < kOpFormats[op].operands; j++) {
+      out << " " << operands[j];
+    }
+    out << std::endl;
+    if (kOpFormats[op].is_block) {
+      ends.push_back(program.GetA(i));
+    }
+  }
+}
+
+static bool ReadBinary(std::istream& in, CompactProgram* program,
+                       std::string* error) {
+  char magic[kBinaryMagicSize];
+  uint32_t version;
+  uint32_t count;
+  if (!in.read(magic, kBinaryMagicSize) || !ReadWord(in, &version) ||
+      !ReadWord(in, &count)) {
+    *error = "truncated header";
+    return false;
+  }
+  if (version == 0 || version > kCanonFileVersion) {
+    *error = "unsupported version " + std::to_string(version);
+    return false;
+  }
+
+  // Ends of the open blocks, innermost last; each body must lie inside
+  // the one around it
+  std::vector<uint32_t> ends;
+  for (uint32_t i = 0; i < count; i++) {
+    while (!ends.empty() && ends.back() == i) {
+      ends.pop_back();
+    }
+    int op = in.get();
+    if (op < 0 || op >= kOpCount) {
+      *error = "bad opcode at instruction " + std::to_string(i);
+      return false;
+    }
+    uint32_t end = 0;
+    if (kOpFormats[op].is_block) {
+      uint32_t limit = ends.empty() ? count : ends.back();
+      if (!ReadWord(in, &end) || end <= i || end > limit) {
+        *error = "bad block end at instruction " + std::to_string(i);
+        return false;
+      }
+    }
+    int32_t operands[kMaxOperands];
+    for (int j = 0; j < kOpFormats[op].operands; j++) {
+      uint32_t word;
+      if (!ReadWord(in, &word)) {
+        *error = "truncated at instruction " + std::to_string(i);
+        return false;
+      }
+      operands[j] = word;
+    }
+    if (!AppendInstruction(program, static_cast<CompactOp>(op), end,
+                           operands)) {
+      *error = "bad operands at instruction " + std::to_string(i);
+      return false;
+    }
+    if (kOpFormats[op].is_block) {
+      ends.push_back(end);
+    }
+  }
+  return true;
+}
+
+static bool ReadText(std::istream& in, CompactProgram* program,
+                     std::string* error) {
+  std::string header;
+  uint32_t version;
+  if (!(in >> header >> version) || header != kTextHeader) {
+    *error = "missing header";
+    return false;
+  }
+  if (version == 0 || version > kCanonFileVersion) {
+    *error = "unsupported version " + std::to_string(version);
+    return false;
+  }
+
+  // Starts of the open blocks, whose ends are set at their "end" line
+  std::vector<size_t> starts;
+  std::string line;
+  int line_number = 1;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string name;
+    if (!(fields >> name) || name[0] == '#') {
+      line_number++;
+      continue;
+    }
+    std::string where = " on line " + std::to_string(line_number++);
+
+    if (name == "end") {
+      if (starts.empty()) {
+        *error = "unmatched end" + where;
+        return false;
+      }
+      program->SetA(starts.back(), program->Size());
+      starts.pop_back();
+      continue;
+    }
+    int op = 0;
+    while (op < kOpCount && name != kOpFormats[op].name) {
+      op++;
+    }
+    if (op == kOpCount) {
+      *error = "unknown instruction " + name + where;
+      return false;
+    }
+    int32_t operands[kMaxOperands];
+    for (int j = 0; j < kOpFormats[op].operands; j++) {
+      if (!(fields >> operands[j])) {
+        *error = "missing operand" + where;
+        return false;
+      }
+    }
+    std::string rest;
+    if (fields >> rest) {
+      *error = "extra operand" + where;
+      return false;
+    }
+    if (kOpFormats[op].is_block) {
+      starts.push_back(program->Size());
+    }
+    if (!AppendInstruction(program, static_cast<CompactOp>(op), 0,
+                           operands)) {
+      *error = "bad operands" + where;
+      return false;
+    }
+  }
+  if (!starts.empty()) {
+    *error = "block without end";
+    return false;
+  }
+  return true;
+}
+
+// Returns false if a body at or after n breaks a rule the passes keep and
+// codegen relies on: if and counted loop bodies end where they started,
+// and a counted loop body changes its loop cell only by the step
+// index counts the instructions walked, as numbered in the file
+static bool CheckBodies(CNode* n, BodyAccessCache* cache, size_t* index) {
+  for (; n; n = n->GetNextCNode()) {
+    size_t at = (*index)++;
+    CNode* body = NULL;
+    bool balanced = false;
+    if (CLoop* loop = dynamic_cast<CLoop*>(n)) {
+      body = loop->GetBody();
+    } else if (CIf* if_node = dynamic_cast<CIf*>(n)) {
+      body = if_node->GetBody();
+      balanced = true;
+    } else if (CCountedLoop* loop = dynamic_cast<CCountedLoop*>(n)) {
+      body = loop->GetBody();
+      const BodyAccess& access = GetBodyAccess(body, cache);
+      auto step = access.adds.find(0);
+      if (!access.IsTracked() || access.other_writes.count(0) ||
+          step == access.adds.end() ||
+          Wrap(step->second) != loop->GetStep()) {
+        *index = at;
+        return false;
+      }
+    } else if (CDivMod* div_mod = dynamic_cast<CDivMod*>(n)) {
+      body = div_mod->GetBody();
+    }
+    if (!body) {
+      continue;
+    }
+    if (balanced && !GetBodyAccess(body, cache).IsBalanced()) {
+      *index = at;
+      return false;
+    }
+    if (!CheckBodies(body->GetNextCNode(), cache, index)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool SaveCanonIR(CNode* n, const std::string& path, bool text,
+                 std::string* error) {
+  CompactProgram program;
+  EncodeCanonIR(n, &program);
+  std::ofstream out(path, std::ios::binary);
+  if (text) {
+    WriteText(program, out);
+  } else {
+    WriteBinary(program, out);
+  }
+  if (!out) {
+    *error = "Can't write " + path;
+    return false;
+  }
+  return true;
+}
+
+CNode* LoadCanonIR(const std::string& path, std::string* error) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    *error = "Can't read " + path;
+    return NULL;
+  }
+  char magic[kBinaryMagicSize] = {};
+  in.read(magic, kBinaryMagicSize);
+  in.clear();
+  in.seekg(0);
+
+  CompactProgram program;
+  bool ok = memcmp(magic, kBinaryMagic, kBinaryMagicSize) == 0
+                ? ReadBinary(in, &program, error)
+                : ReadText(in, &program, error);
+  if (!ok) {
+    *error = path + ": " + *error;
+    return NULL;
+  }
+  std::unique_ptr<CNode> n(DecodeCanonIR(program, 0, program.Size()));
+  BodyAccessCache cache;
+  size_t index = 0;
+  if (!CheckBodies(n->GetNextCNode(), &cache, &index)) {
+    *error = path + ": bad operands at instruction " + std::to_string(index);
+    return NULL;
+  }
+  return n.release();
+}
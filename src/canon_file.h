@@ -0,0 +1,31 @@
+#ifndef CANON_FILE
+#define CANON_FILE
+
+#include <string>
+
+#include "canon_ir.h"
+
+// Canonical IR saved to a file, so the BF passes run once per program
+// and later runs start from their result
+// Both formats start with a version, and files from a newer version are
+// refused rather than guessed at
+//
+// Binary: "BFIR", then the version, the instruction count, and each
+// instruction in compact_ir.h order as an opcode byte followed by its
+// operands, all 32-bit little-endian; block instructions give the index
+// one past their body before their other operands
+//
+// Text: a "bf-canon-ir <version>" line, then one instruction per line,
+// e.g. "add 1 -3" or "div_mod 10 1 2 3", with each block's body indented
+// below it and closed by "end"; blank lines and lines starting with #
+// are skipped
+bool SaveCanonIR(CNode* n, const std::string& path, bool text,
+                 std::string* error);
+
+// Reads either format, telling them apart by the first bytes
+// Returns NULL and sets error if the file can't be read or is malformed,
+// which includes bodies that break what the passes guarantee, such as an
+// if body that moves the pointer
+CNode* LoadCanonIR(const std::string& path, std::string* error);
+
+#endif  // CANON_FILE
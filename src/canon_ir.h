@@ -6,11 +6,23 @@
 class CNode;
 class CPtrMov;  // CPtrMov(x) -> ptr += x
 class CAdd;     // CAdd(off,x) -> M[ptr+off] += x
-class CMul;     // CMul(off,x,y) -> M[ptr+off+x] += M[ptr+off]*y
+class CMul;     // CMul(off,x,y) -> M[ptr+x] += M[ptr+off]*y
 class CSet;     // CSet(off,x) -> M[ptr+off] = x
 class CInput;   // CInput(off) -> M[ptr+off] = getchar()
 class COutput;  // COutput(off) -> putchar(M[ptr+off])
 class CLoop;    // CLoop(body) -> while(*ptr) {body}
+class CIf;      // CIf(body) -> if(*ptr) {body}
+class CCountedLoop;  // CCountedLoop(x,body) -> n = trip count of *ptr
+                     //   stepping by x; repeat n times {body}
+class CDivMod;  // CDivMod(d,v,q,r,t,u,body) -> D = d, or M[ptr+v] if d
+                //   is 0 (with 0 standing for 256);
+                //   if M[ptr+r] == M[ptr+t] == M[ptr+u] == 0 and D != 1:
+                //   m = *ptr%D; M[ptr+q] += *ptr/D; M[ptr+r] = m;
+                //   *ptr = 0; if d is 0, M[ptr+v] = D - m
+                // else while(*ptr) {body}
+class CSetRange;   // CSetRange(off,n,x) -> M[ptr+off..ptr+off+n) = x
+class CMoveRange;  // CMoveRange(off,n,d) -> M[ptr+off+d..+n) = M[ptr+off..+n);
+                   //   source cells left outside the copy = 0
 
 class CNodeVisitor {
  public:
@@ -23,6 +35,11 @@ class CNodeVisitor {
   virtual void Visit(CInput* n) = 0;
   virtual void Visit(COutput* n) = 0;
   virtual void Visit(CLoop* n) = 0;
+  virtual void Visit(CIf* n) = 0;
+  virtual void Visit(CCountedLoop* n) = 0;
+  virtual void Visit(CDivMod* n) = 0;
+  virtual void Visit(CSetRange* n) = 0;
+  virtual void Visit(CMoveRange* n) = 0;
 };
 
 class CNode {
@@ -141,4 +158,129 @@ class CLoop : public CNode {
   std::unique_ptr<CNode> body_;
 };
 
+// A loop whose body always leaves the loop cell zero, so it runs at
+// most once
+class CIf : public CNode {
+ public:
+  CIf() {}
+  void Accept(CNodeVisitor& visitor) { visitor.Visit(this); }
+  CNode* GetBody() { return body_.get(); }
+  void SetBody(CNode* body) { body_.reset(body); }
+
+ private:
+  std::unique_ptr<CNode> body_;
+};
+
+// A balanced loop whose body adds the same constant step to the loop
+// cell on every pass and otherwise leaves it alone
+// The trip count is known on entry from the cell and the step
+class CCountedLoop : public CNode {
+ public:
+  CCountedLoop() {}
+  CCountedLoop(int step) { step_ = step; }
+  void Accept(CNodeVisitor& visitor) { visitor.Visit(this); }
+  int GetStep() { return step_; }
+  void SetStep(int step) { step_ = step; }
+  CNode* GetBody() { return body_.get(); }
+  void SetBody(CNode* body) { body_.reset(body); }
+
+ private:
+  int step_ = 0;
+  std::unique_ptr<CNode> body_;
+};
+
+// Division of the loop cell by a constant or by another cell, recognized
+// from a loop
+// The loop is kept as body, and runs instead when the remainder or a
+// temporary cell is not zero on entry
+// A divisor cell's loop may move the pointer by an amount that depends
+// on the cells, so only the closed form is known to be balanced
+class CDivMod : public CNode {
+ public:
+  CDivMod() {}
+  CDivMod(int divisor, int divisor_offset, int quotient_offset,
+          int remainder_offset, int temp_offset, int second_temp_offset) {
+    divisor_ = divisor;
+    divisor_offset_ = divisor_offset;
+    quotient_offset_ = quotient_offset;
+    remainder_offset_ = remainder_offset;
+    temp_offset_ = temp_offset;
+    second_temp_offset_ = second_temp_offset;
+  }
+  void Accept(CNodeVisitor& visitor) { visitor.Visit(this); }
+  // 0 if the divisor is the cell at GetDivisorOffset()
+  int GetDivisor() { return divisor_; }
+  bool HasDivisorCell() { return divisor_ == 0; }
+  int GetDivisorOffset() { return divisor_offset_; }
+  int GetQuotientOffset() { return quotient_offset_; }
+  int GetRemainderOffset() { return remainder_offset_; }
+  int GetTempOffset() { return temp_offset_; }
+  int GetSecondTempOffset() { return second_temp_offset_; }
+  CNode* GetBody() { return body_.get(); }
+  void SetDivisor(int divisor) { divisor_ = divisor; }
+  void SetDivisorOffset(int offset) { divisor_offset_ = offset; }
+  void SetQuotientOffset(int offset) { quotient_offset_ = offset; }
+  void SetRemainderOffset(int offset) { remainder_offset_ = offset; }
+  void SetTempOffset(int offset) { temp_offset_ = offset; }
+  void SetSecondTempOffset(int offset) { second_temp_offset_ = offset; }
+  void SetBody(CNode* body) { body_.reset(body); }
+
+ private:
+  int divisor_ = 1;
+  int divisor_offset_ = 0;
+  int quotient_offset_ = 0;
+  int remainder_offset_ = 0;
+  int temp_offset_ = 0;
+  int second_temp_offset_ = 0;
+  std::unique_ptr<CNode> body_;
+};
+
+// A run of sets of the same value to consecutive cells, written at once
+class CSetRange : public CNode {
+ public:
+  CSetRange() {}
+  CSetRange(int offset, int count, int amt) {
+    offset_ = offset;
+    count_ = count;
+    amt_ = amt;
+  }
+  void Accept(CNodeVisitor& visitor) { visitor.Visit(this); }
+  int GetOffset() { return offset_; }
+  int GetCount() { return count_; }
+  int GetAmt() { return amt_; }
+  void SetOffset(int offset) { offset_ = offset; }
+  void SetCount(int count) { count_ = count; }
+  void SetAmt(int amt) { amt_ = amt; }
+
+ private:
+  int offset_ = 0;
+  int count_ = 0;
+  int amt_ = 0;
+};
+
+// A block of consecutive cells moved distance cells over, as a chain of
+// moves like [->+<]< unrolls into
+// The cells the block leaves behind are zeroed
+class CMoveRange : public CNode {
+ public:
+  CMoveRange() {}
+  CMoveRange(int offset, int count, int distance) {
+    offset_ = offset;
+    count_ = count;
+    distance_ = distance;
+  }
+  void Accept(CNodeVisitor& visitor) { visitor.Visit(this); }
+  int GetOffset() { return offset_; }
+  int GetCount() { return count_; }
+  int GetDistance() { return distance_; }
+  void SetOffset(int offset) { offset_ = offset; }
+  void SetCount(int count) { count_ = count; }
+  void SetDistance(int distance) { distance_ = distance; }
+
+ private:
+  int offset_ = 0;
+  int count_ = 0;
+  int distance_ = 0;
+};
+
 #endif  // CANON_IR
@@ -99,6 +99,73 @@ void CanonicalizeVisitor::Visit(CLoop* n) {
   VisitNextCNode(n);
 }
 
+void CanonicalizeVisitor::Visit(CIf* n) {
+  FinishBB();
+  CNode* body_node = new CNode();
+
+  StartBB();
+  blocks_.push(body_node);
+  n->GetBody()->Accept(*this);
+  blocks_.pop();
+
+  CIf* if_node = new CIf();
+  if_node->SetBody(body_node);
+  AddSimpleStatement(if_node);
+  StartBB();
+  VisitNextCNode(n);
+}
+
+void CanonicalizeVisitor::Visit(CCountedLoop* n) {
+  FinishBB();
+  CNode* body_node = new CNode();
+
+  StartBB();
+  blocks_.push(body_node);
+  n->GetBody()->Accept(*this);
+  blocks_.pop();
+
+  CCountedLoop* loop = new CCountedLoop(n->GetStep());
+  loop->SetBody(body_node);
+  AddSimpleStatement(loop);
+  StartBB();
+  VisitNextCNode(n);
+}
+
+void CanonicalizeVisitor::Visit(CDivMod* n) {
+  FinishBB();
+  CNode* body_node = new CNode();
+
+  StartBB();
+  blocks_.push(body_node);
+  n->GetBody()->Accept(*this);
+  blocks_.pop();
+
+  CDivMod* div_mod =
+      new CDivMod(n->GetDivisor(), n->GetDivisorOffset(),
+                  n->GetQuotientOffset(), n->GetRemainderOffset(),
+                  n->GetTempOffset(), n->GetSecondTempOffset());
+  div_mod->SetBody(body_node);
+  AddSimpleStatement(div_mod);
+  StartBB();
+  VisitNextCNode(n);
+}
+
+void CanonicalizeVisitor::Visit(CSetRange* n) {
+  FinishBB();
+  AddSimpleStatement(
+      new CSetRange(n->GetOffset(), n->GetCount(), n->GetAmt()));
+  StartBB();
+  VisitNextCNode(n);
+}
+
+void CanonicalizeVisitor::Visit(CMoveRange* n) {
+  FinishBB();
+  AddSimpleStatement(
+      new CMoveRange(n->GetOffset(), n->GetCount(), n->GetDistance()));
+  StartBB();
+  VisitNextCNode(n);
+}
+
 CNode* CanonicalizeBasicBlocks(CNode* n) {
   CanonicalizeVisitor visitor;
   if (n) {
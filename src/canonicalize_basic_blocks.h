@@ -24,6 +24,11 @@ class CanonicalizeVisitor : public CNodeVisitor {
   void Visit(CInput* n);
   void Visit(COutput* n);
   void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
 
   CNode* GetProgram() { return start_node_; }
 
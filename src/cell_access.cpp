@@ -0,0 +1,172 @@
+#include <map>
+#include <set>
+
+#include "canon_ir.h"
+#include "cell_access.h"
+
+// Bodies that reach further than this are too big to keep in registers
+// or to reason about cell by cell, and listing them would make the
+// summaries of deep nests grow with their depth
+static const size_t kMaxTrackedCells = 256;
+
+const BodyAccess& GetBodyAccess(CNode* body, BodyAccessCache* cache) {
+  auto it = cache->find(body);
+  if (it == cache->end()) {
+    CellAccessVisitor visitor(cache);
+    body->Accept(visitor);
+    it = cache->insert(std::make_pair(body, visitor.GetAccess())).first;
+  }
+  return it->second;
+}
+
+CellAccessVisitor::CellAccessVisitor(BodyAccessCache* cache) {
+  cache_ = cache;
+}
+
+void CellAccessVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  }
+}
+
+void CellAccessVisitor::CheckTracked() {
+  if (access_.known && access_.reads.size() <= kMaxTrackedCells &&
+      access_.writes.size() <= kMaxTrackedCells) {
+    return;
+  }
+  access_.tracked = false;
+  access_.reads.clear();
+  access_.writes.clear();
+  access_.adds.clear();
+  access_.other_writes.clear();
+}
+
+void CellAccessVisitor::AddRead(int offset) {
+  if (!access_.tracked) {
+    return;
+  }
+  access_.reads.insert(access_.ptr_mov + offset);
+  CheckTracked();
+}
+
+void CellAccessVisitor::AddWrite(int offset) {
+  if (!access_.tracked) {
+    return;
+  }
+  access_.writes.insert(access_.ptr_mov + offset);
+  access_.other_writes.insert(access_.ptr_mov + offset);
+  CheckTracked();
+}
+
+void CellAccessVisitor::VisitNested(CNode* body) {
+  const BodyAccess& nested = GetBodyAccess(body, cache_);
+  if (!nested.IsBalanced()) {
+    access_.known = false;
+  }
+  if (!nested.tracked) {
+    access_.tracked = false;
+  }
+  access_.has_io = access_.has_io || nested.has_io;
+
+  // The loop condition reads the current cell
+  AddRead(0);
+  for (int offset : nested.reads) {
+    AddRead(offset);
+  }
+  for (int offset : nested.writes) {
+    AddWrite(offset);
+  }
+  CheckTracked();
+}
+
+void CellAccessVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void CellAccessVisitor::Visit(CPtrMov* n) {
+  access_.ptr_mov += n->GetAmt();
+  VisitNextCNode(n);
+}
+
+void CellAccessVisitor::Visit(CAdd* n) {
+  if (access_.tracked) {
+    int offset = access_.ptr_mov + n->GetOffset();
+    access_.reads.insert(offset);
+    access_.writes.insert(offset);
+    access_.adds[offset] += n->GetAmt();
+    CheckTracked();
+  }
+  VisitNextCNode(n);
+}
+
+void CellAccessVisitor::Visit(CMul* n) {
+  AddRead(n->GetOpOffset());
+  AddRead(n->GetTargetOffset());
+  AddWrite(n->GetTargetOffset());
+  VisitNextCNode(n);
+}
+
+void CellAccessVisitor::Visit(CSet* n) {
+  AddWrite(n->GetOffset());
+  VisitNextCNode(n);
+}
+
+void CellAccessVisitor::Visit(CInput* n) {
+  access_.has_io = true;
+  AddWrite(n->GetOffset());
+  VisitNextCNode(n);
+}
+
+void CellAccessVisitor::Visit(COutput* n) {
+  access_.has_io = true;
+  AddRead(n->GetOffset());
+  VisitNextCNode(n);
+}
+
+void CellAccessVisitor::Visit(CLoop* n) {
+  VisitNested(n->GetBody());
+  VisitNextCNode(n);
+}
+
+void CellAccessVisitor::Visit(CIf* n) {
+  VisitNested(n->GetBody());
+  VisitNextCNode(n);
+}
+
+void CellAccessVisitor::Visit(CCountedLoop* n) {
+  VisitNested(n->GetBody());
+  VisitNextCNode(n);
+}
+
+void CellAccessVisitor::Visit(CSetRange* n) {
+  for (int i = 0; i < n->GetCount(); i++) {
+    AddWrite(n->GetOffset() + i);
+  }
+  VisitNextCNode(n);
+}
+
+void CellAccessVisitor::Visit(CMoveRange* n) {
+  for (int i = 0; i < n->GetCount(); i++) {
+    AddRead(n->GetOffset() + i);
+    AddWrite(n->GetOffset() + i);
+    AddWrite(n->GetOffset() + n->GetDistance() + i);
+  }
+  VisitNextCNode(n);
+}
+
+void CellAccessVisitor::Visit(CDivMod* n) {
+  VisitNested(n->GetBody());
+
+  // The closed form touches the same cells as the loop, but say so
+  AddRead(n->GetRemainderOffset());
+  AddRead(n->GetTempOffset());
+  AddRead(n->GetSecondTempOffset());
+  AddRead(n->GetQuotientOffset());
+  AddWrite(n->GetQuotientOffset());
+  AddWrite(n->GetRemainderOffset());
+  if (n->HasDivisorCell()) {
+    AddRead(n->GetDivisorOffset());
+    AddWrite(n->GetDivisorOffset());
+  }
+  AddWrite(0);
+  VisitNextCNode(n);
+}
@@ -0,0 +1,76 @@
+#ifndef CELL_ACCESS
+#define CELL_ACCESS
+
+#include <map>
+#include <set>
+
+#include "canon_ir.h"
+
+// The cells a body reads and writes, as offsets from the pointer on
+// entry
+// Nested loops must be balanced for their accesses to be known
+struct BodyAccess {
+  std::set<int> reads;
+  std::set<int> writes;
+  // Net constant added to each cell by unconditional CAdds
+  std::map<int, int> adds;
+  // Cells written by anything other than an unconditional CAdd
+  std::set<int> other_writes;
+  // False once a nested body leaves the pointer somewhere unknown
+  bool known = true;
+  // False if the body touches too many cells to list, in which case the
+  // sets above are left empty
+  bool tracked = true;
+  bool has_io = false;
+  int ptr_mov = 0;
+
+  // True if the body ends where it started
+  bool IsBalanced() const { return known && ptr_mov == 0; }
+  // True if the body is balanced and the sets above hold every access
+  bool IsTracked() const { return IsBalanced() && tracked; }
+  // True if every trip moves the pointer by the same nonzero amount, so a
+  // loop over the body leaves the tape after a bounded number of trips
+  bool IsMoving() const { return known && ptr_mov != 0; }
+};
+
+// Summaries by body, so that a pass asking about every loop walks each
+// body once however deeply it is nested
+typedef std::map<CNode*, BodyAccess> BodyAccessCache;
+
+// Returns the summary of body, filling in cache for it and the bodies
+// nested in it if they are missing
+const BodyAccess& GetBodyAccess(CNode* body, BodyAccessCache* cache);
+
+// Collects the accesses of the nodes it visits, taking nested bodies'
+// from cache
+class CellAccessVisitor : public CNodeVisitor {
+ public:
+  explicit CellAccessVisitor(BodyAccessCache* cache);
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  const BodyAccess& GetAccess() { return access_; }
+
+ private:
+  void VisitNextCNode(CNode* n);
+  void VisitNested(CNode* body);
+  void AddRead(int offset);
+  void AddWrite(int offset);
+  // Gives up on listing cells once there are too many to be of use
+  void CheckTracked();
+  BodyAccess access_;
+  BodyAccessCache* cache_;
+};
+
+#endif  // CELL_ACCESS
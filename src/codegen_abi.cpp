@@ -0,0 +1,262 @@
+#include <vector>
+
+#include <llvm/IR/DerivedTypes.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include "codegen_abi.h"
+#include "runtime.h"
+
+using namespace llvm;
+
+// Field numbers of BFContext in runtime.h
+enum ContextField {
+  CTX_TAPE = 0,
+  CTX_TAPE_SIZE,
+  CTX_INPUT,
+  CTX_INPUT_LEN,
+  CTX_INPUT_POS,
+  CTX_OUTPUT,
+  CTX_OUTPUT_LEN,
+  CTX_OUTPUT_POS,
+  CTX_STEPS,
+  CTX_BUDGET,
+  CTX_DEADLINE,
+  CTX_SINK,
+  CTX_SOURCE,
+  CTX_USER
+};
+
+StructType* CodeGenABI::GetContextType(Module* module) {
+  StructType* type = module->getTypeByName("BFContext");
+  if (type) {
+    return type;
+  }
+  // Function pointers and user data are opaque to generated code
+  std::vector<Type*> fields = {
+      store_type_, size_type_, store_type_, size_type_,
+      size_type_,  store_type_, size_type_, size_type_,
+      size_type_,  size_type_,  size_type_, store_type_,
+      store_type_, store_type_};
+  return StructType::create(module->getContext(), fields, "BFContext");
+}
+
+CodeGenABI::CodeGenABI(Module* module, const CodeGenOptions& options) {
+  // Types come from the module's context, which need not be the global one
+  LLVMContext& context = module->getContext();
+  void_type_ = Type::getVoidTy(context);
+  cell_type_ = IntegerType::get(context, 8);
+  size_type_ = IntegerType::get(context, 64);
+  status_type_ = IntegerType::get(context, 32);
+  store_type_ = PointerType::get(cell_type_, 0);
+
+  kind_ = options.abi;
+  store_size_ = options.store_size;
+  count_steps_ = options.count_steps && kind_ == ABI_CONTEXT;
+  ctx_ = nullptr;
+  out_of_steps_ = nullptr;
+  refill_ = nullptr;
+  steps_ = nullptr;
+
+  if (kind_ == ABI_CONTEXT) {
+    PointerType* ctx_type = PointerType::get(GetContextType(module), 0);
+    get_char_ = cast<Function>(module->getOrInsertFunction(
+        "bf_ctx_read", cell_type_, ctx_type, NULL));
+    put_char_ = cast<Function>(module->getOrInsertFunction(
+        "bf_ctx_write", void_type_, ctx_type, cell_type_, NULL));
+    refill_ = cast<Function>(module->getOrInsertFunction(
+        "bf_ctx_refill", status_type_, ctx_type, size_type_, NULL));
+    refill_->setCallingConv(CallingConv::C);
+    main_ = cast<Function>(
+        module->getOrInsertFunction("bf_run", status_type_, ctx_type, NULL));
+    ctx_ = &*main_->arg_begin();
+    ctx_->setName("ctx");
+  } else {
+    get_char_ = cast<Function>(
+        module->getOrInsertFunction("getchar", cell_type_, NULL));
+    put_char_ = cast<Function>(
+        module->getOrInsertFunction("putchar", void_type_, cell_type_, NULL));
+    if (kind_ == ABI_REGION) {
+      main_ = cast<Function>(module->getOrInsertFunction(
+          options.region_name, store_type_, store_type_, NULL));
+      main_->arg_begin()->setName("ptr");
+    } else {
+      main_ = cast<Function>(
+          module->getOrInsertFunction("main", void_type_, NULL));
+    }
+  }
+  get_char_->setCallingConv(CallingConv::C);
+  put_char_->setCallingConv(CallingConv::C);
+  main_->setCallingConv(CallingConv::C);
+}
+
+Value* CodeGenABI::GetField(IRBuilder<>& builder, unsigned field) {
+  return builder.CreateStructGEP(ctx_, field);
+}
+
+BasicBlock* CodeGenABI::GetOutOfStepsBlock() {
+  if (!out_of_steps_) {
+    out_of_steps_ =
+        BasicBlock::Create(main_->getContext(), "out_of_steps", main_);
+    IRBuilder<> builder(out_of_steps_);
+    builder.CreateRet(ConstantInt::get(status_type_, BF_OUT_OF_STEPS));
+  }
+  return out_of_steps_;
+}
+
+Value* CodeGenABI::EmitPrologue(IRBuilder<>& builder) {
+  if (kind_ == ABI_CONTEXT) {
+    if (count_steps_) {
+      // Counted in a local, which mem2reg keeps in a register; ctx only
+      // sees it around calls to bf_ctx_refill
+      steps_ = builder.CreateAlloca(size_type_, nullptr, "steps");
+      builder.CreateStore(builder.CreateLoad(GetField(builder, CTX_STEPS)),
+                          steps_);
+    }
+    // The caller owns the tape and has already zeroed it
+    return builder.CreateLoad(GetField(builder, CTX_TAPE), "tape");
+  }
+  if (kind_ == ABI_REGION) {
+    // Carries on from wherever the previous region stopped
+    return &*main_->arg_begin();
+  }
+
+  // Allocate the tape as a fixed-size array, which SROA can split up
+  // when every access is at a constant position
+  Value* tape = builder.CreateAlloca(ArrayType::get(cell_type_, store_size_));
+  Value* ptr = builder.CreateConstGEP2_32(tape, 0, 0);
+
+  // Zero-out the data array
+  builder.CreateMemSet(ptr, ConstantInt::get(cell_type_, 0), store_size_, 0);
+  return ptr;
+}
+
+Value* CodeGenABI::EmitInput(IRBuilder<>& builder) {
+  if (kind_ != ABI_CONTEXT) {
+    return builder.CreateCall(get_char_);
+  }
+
+  BasicBlock* fast_block = BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* slow_block = BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* done_block = BasicBlock::Create(main_->getContext(), "", main_);
+
+  // Read straight from the input buffer while it lasts
+  Value* pos_ptr = GetField(builder, CTX_INPUT_POS);
+  Value* pos = builder.CreateLoad(pos_ptr);
+  Value* len = builder.CreateLoad(GetField(builder, CTX_INPUT_LEN));
+  builder.CreateCondBr(builder.CreateICmpULT(pos, len), fast_block,
+                       slow_block);
+
+  builder.SetInsertPoint(fast_block);
+  Value* input = builder.CreateLoad(GetField(builder, CTX_INPUT));
+  Value* fast_value = builder.CreateLoad(builder.CreateGEP(input, pos));
+  builder.CreateStore(builder.CreateAdd(pos, ConstantInt::get(size_type_, 1)),
+                      pos_ptr);
+  builder.CreateBr(done_block);
+
+  builder.SetInsertPoint(slow_block);
+  Value* slow_value = builder.CreateCall(get_char_, ctx_);
+  builder.CreateBr(done_block);
+
+  builder.SetInsertPoint(done_block);
+  PHINode* value = builder.CreatePHI(cell_type_, 2);
+  value->addIncoming(fast_value, fast_block);
+  value->addIncoming(slow_value, slow_block);
+  return value;
+}
+
+void CodeGenABI::EmitOutput(IRBuilder<>& builder, Value* value) {
+  if (kind_ != ABI_CONTEXT) {
+    builder.CreateCall(put_char_, value);
+    return;
+  }
+
+  BasicBlock* fast_block = BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* slow_block = BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* done_block = BasicBlock::Create(main_->getContext(), "", main_);
+
+  // Write straight to the output buffer until it is full
+  Value* pos_ptr = GetField(builder, CTX_OUTPUT_POS);
+  Value* pos = builder.CreateLoad(pos_ptr);
+  Value* len = builder.CreateLoad(GetField(builder, CTX_OUTPUT_LEN));
+  builder.CreateCondBr(builder.CreateICmpULT(pos, len), fast_block,
+                       slow_block);
+
+  builder.SetInsertPoint(fast_block);
+  Value* output = builder.CreateLoad(GetField(builder, CTX_OUTPUT));
+  builder.CreateStore(value, builder.CreateGEP(output, pos));
+  builder.CreateStore(builder.CreateAdd(pos, ConstantInt::get(size_type_, 1)),
+                      pos_ptr);
+  builder.CreateBr(done_block);
+
+  builder.SetInsertPoint(slow_block);
+  builder.CreateCall2(put_char_, ctx_, value);
+  builder.CreateBr(done_block);
+
+  builder.SetInsertPoint(done_block);
+}
+
+void CodeGenABI::EmitBackEdge(IRBuilder<>& builder) {
+  if (count_steps_) {
+    EmitCheckedCharge(builder, 1);
+  }
+}
+
+void CodeGenABI::EmitCheckedCharge(IRBuilder<>& builder, uint64_t count) {
+  Value* amount = ConstantInt::get(size_type_, count);
+  BasicBlock* fast_block = BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* refill_block =
+      BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* refilled_block =
+      BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* continue_block =
+      BasicBlock::Create(main_->getContext(), "", main_);
+
+  // Only the last charge of a slice leaves generated code; steps is
+  // signed, since unchecked charges may have overdrawn it
+  Value* steps = builder.CreateLoad(steps_);
+  builder.CreateCondBr(builder.CreateICmpSGT(steps, amount), fast_block,
+                       refill_block);
+
+  builder.SetInsertPoint(fast_block);
+  builder.CreateStore(builder.CreateSub(steps, amount), steps_);
+  builder.CreateBr(continue_block);
+
+  builder.SetInsertPoint(refill_block);
+  Value* steps_ptr = GetField(builder, CTX_STEPS);
+  builder.CreateStore(steps, steps_ptr);
+  Value* refilled = builder.CreateCall2(refill_, ctx_, amount);
+  builder.CreateCondBr(builder.CreateIsNull(refilled), GetOutOfStepsBlock(),
+                       refilled_block);
+
+  builder.SetInsertPoint(refilled_block);
+  builder.CreateStore(builder.CreateLoad(steps_ptr), steps_);
+  builder.CreateBr(continue_block);
+
+  builder.SetInsertPoint(continue_block);
+}
+
+void CodeGenABI::EmitCharge(IRBuilder<>& builder, Value* amount) {
+  if (count_steps_) {
+    builder.CreateStore(builder.CreateSub(builder.CreateLoad(steps_), amount),
+                        steps_);
+  }
+}
+
+void CodeGenABI::EmitReturn(IRBuilder<>& builder, Value* ptr) {
+  if (kind_ == ABI_CONTEXT) {
+    if (count_steps_) {
+      // Unchecked charges since the last back-edge may have used up the
+      // budget too
+      EmitCheckedCharge(builder, 0);
+      builder.CreateStore(builder.CreateLoad(steps_),
+                          GetField(builder, CTX_STEPS));
+    }
+    builder.CreateRet(ConstantInt::get(status_type_, BF_OK));
+  } else if (kind_ == ABI_REGION) {
+    builder.CreateRet(ptr);
+  } else {
+    builder.CreateRetVoid();
+  }
+}
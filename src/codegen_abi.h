@@ -0,0 +1,104 @@
+#ifndef CODEGEN_ABI
+#define CODEGEN_ABI
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+
+#include "loop_profile.h"
+
+// How the generated entry point talks to the outside world
+enum ABIKind {
+  // void main(), allocates its own tape and uses getchar and putchar
+  ABI_STANDALONE,
+  // i32 bf_run(BFContext* ctx), see runtime.h
+  // Keeps no state outside ctx, so it may run on many threads at once
+  ABI_CONTEXT,
+  // char* bf_region(char* ptr), one piece of a program compiled on its
+  // own, see parallel_compile.h
+  // Uses getchar and putchar, and returns the final data pointer
+  ABI_REGION
+};
+
+struct CodeGenOptions {
+  int store_size = 10000;
+  ABIKind abi = ABI_STANDALONE;
+  // Charge a step on every loop back-edge, ABI_CONTEXT only, see
+  // SetBudget in runtime.h
+  bool count_steps = false;
+  // Group updates to nearby cells into vector operations
+  bool vectorize = true;
+  // Keep the cells of balanced loops in registers while they run
+  bool promote_cells = true;
+  // Loops without I/O that occur more than once and have at least this
+  // many instructions are emitted once, as a function called from each
+  // site; 0 inlines every loop
+  unsigned outline_min_size = 16;
+  // Name of the ABI_REGION entry point
+  std::string region_name = "bf_region";
+  // Recorded loop counts, used for branch weights and per-loop choices
+  const LoopProfile* loop_profile = nullptr;
+  // Line of each node in debug_file, a dump from PrintCanonIR
+  // When set, instructions get debug locations there, and outlined loops
+  // keep their symbols so the JIT can name them
+  const std::map<CNode*, int>* debug_lines = nullptr;
+  std::string debug_file;
+};
+
+// Shared by the code generators so they agree on the entry point,
+// the tape, and how I/O is performed
+// Emit* methods may start new blocks, leaving the builder at the end of
+// the last one
+class CodeGenABI {
+ public:
+  CodeGenABI(llvm::Module* module, const CodeGenOptions& options);
+
+  llvm::Function* GetMain() { return main_; }
+
+  // Sets up the tape at the builder and returns a pointer to its start
+  llvm::Value* EmitPrologue(llvm::IRBuilder<>& builder);
+  // Returns the next input byte
+  llvm::Value* EmitInput(llvm::IRBuilder<>& builder);
+  void EmitOutput(llvm::IRBuilder<>& builder, llvm::Value* value);
+  // Charges one step for taking a loop back-edge, stopping the run once
+  // the budget is used up
+  void EmitBackEdge(llvm::IRBuilder<>& builder);
+  // Charges amount steps at once, for the trips of a loop that can't run
+  // forever; amount is a size_type_ value
+  // Nothing is checked, so the run stops at the next back-edge or on
+  // return instead
+  void EmitCharge(llvm::IRBuilder<>& builder, llvm::Value* amount);
+  // ptr is the final data pointer, which ABI_REGION returns
+  void EmitReturn(llvm::IRBuilder<>& builder, llvm::Value* ptr = nullptr);
+
+ private:
+  llvm::StructType* GetContextType(llvm::Module* module);
+  llvm::Value* GetField(llvm::IRBuilder<>& builder, unsigned field);
+  llvm::BasicBlock* GetOutOfStepsBlock();
+  // Charges count steps, returning BF_OUT_OF_STEPS if that leaves less
+  // than one
+  void EmitCheckedCharge(llvm::IRBuilder<>& builder, uint64_t count);
+  llvm::Type* void_type_;
+  llvm::IntegerType* cell_type_;
+  llvm::IntegerType* size_type_;
+  llvm::IntegerType* status_type_;
+  llvm::PointerType* store_type_;
+  ABIKind kind_;
+  int store_size_;
+  bool count_steps_;
+  llvm::Function* get_char_;
+  llvm::Function* put_char_;
+  llvm::Function* refill_;
+  llvm::Function* main_;
+  llvm::Value* ctx_;
+  // Local copy of ctx->steps
+  llvm::Value* steps_;
+  llvm::BasicBlock* out_of_steps_;
+};
+
+#endif  // CODEGEN_ABI
@@ -11,42 +11,23 @@
 
 using namespace llvm;
 
-static Type* VOID_TYPE = Type::getVoidTy(getGlobalContext());
 static IntegerType* CELL_TYPE = IntegerType::get(getGlobalContext(), 8);
-static IntegerType* INDEX_TYPE = IntegerType::get(getGlobalContext(), 32);
 static PointerType* STORE_TYPE = PointerType::get(CELL_TYPE, 0);
-static Value* zero = ConstantInt::get(CELL_TYPE, 0);
 static Value* one = ConstantInt::get(CELL_TYPE, 1);
 static Value* neg_one = ConstantInt::get(CELL_TYPE, -1);
 
-ASTCodeGenVisitor::ASTCodeGenVisitor(Module* module, int store_size) {
+ASTCodeGenVisitor::ASTCodeGenVisitor(Module* module,
+                                     const CodeGenOptions& options)
+    : abi_(module, options) {
   module_ = module;
-
-  // Define function for getting input
-  get_char_ =
-      cast<Function>(module_->getOrInsertFunction("getchar", CELL_TYPE, NULL));
-  get_char_->setCallingConv(CallingConv::C);
-
-  // Define function for printing
-  put_char_ = cast<Function>(
-      module_->getOrInsertFunction("putchar", VOID_TYPE, CELL_TYPE, NULL));
-  put_char_->setCallingConv(CallingConv::C);
-
-  // Define main function
-  main_ = cast<Function>(module_->getOrInsertFunction("main", VOID_TYPE, NULL));
-  main_->setCallingConv(CallingConv::C);
+  main_ = abi_.GetMain();
 
   // Push the main block onto a stack of loops
   IRBuilder<> builder(BasicBlock::Create(getGlobalContext(), "code", main_));
   builders_.push(builder);
 
-  Value* store_size_v = ConstantInt::get(INDEX_TYPE, store_size);
-
-  // Allocate the data pointer, an array of size store_size
-  ptr_ = builder.CreateAlloca(CELL_TYPE, store_size_v);
-
-  // Zero-out the data array
-  builder.CreateMemSet(ptr_, zero, store_size, 0);
+  // Allocate the data pointer
+  ptr_ = abi_.EmitPrologue(builder);
 }
 
 void ASTCodeGenVisitor::VisitNextASTNode(ASTNode* s) {
@@ -87,16 +68,16 @@ void ASTCodeGenVisitor::Visit(DecrData* s) {
 }
 
 void ASTCodeGenVisitor::Visit(GetInput* s) {
-  IRBuilder<> builder = builders_.top();
-  Value* input = builder.CreateCall(get_char_);
+  IRBuilder<>& builder = builders_.top();
+  Value* input = abi_.EmitInput(builder);
   builder.CreateStore(input, ptr_);
   VisitNextASTNode(s);
 }
 
 void ASTCodeGenVisitor::Visit(Output* s) {
-  IRBuilder<> builder = builders_.top();
+  IRBuilder<>& builder = builders_.top();
   Value* output = builder.CreateLoad(ptr_);
-  builder.CreateCall(put_char_, output);
+  abi_.EmitOutput(builder, output);
   VisitNextASTNode(s);
 }
 
@@ -138,7 +119,8 @@ void ASTCodeGenVisitor::Visit(BFLoop* s) {
   s->GetBody()->Accept(*this);
 
   // Body could have progressed to a new block
-  IRBuilder<> new_body_builder = builders_.top();
+  IRBuilder<>& new_body_builder = builders_.top();
+  abi_.EmitBackEdge(new_body_builder);
   BasicBlock* new_body_block = new_body_builder.GetInsertBlock();
 
   // Create a conditional branch to restart the loop
@@ -164,11 +146,11 @@ void ASTCodeGenVisitor::Visit(BFLoop* s) {
 }
 
 Function* BuildProgramFromAST(ASTNode* s, llvm::Module* module,
-                              int store_size) {
-  ASTCodeGenVisitor visitor(module, store_size);
+                              const CodeGenOptions& options) {
+  ASTCodeGenVisitor visitor(module, options);
   s->Accept(visitor);
   IRBuilder<> builder = visitor.GetLastBuilder();
-  builder.CreateRetVoid();
+  visitor.GetABI().EmitReturn(builder);
   Function* func = visitor.GetMain();
   return func;
 }
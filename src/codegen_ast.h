@@ -8,11 +8,12 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 
+#include "codegen_abi.h"
 #include "parser.h"
 
 class ASTCodeGenVisitor : public ASTNodeVisitor {
  public:
-  ASTCodeGenVisitor(llvm::Module* module, int store_size);
+  ASTCodeGenVisitor(llvm::Module* module, const CodeGenOptions& options);
   void Visit(ASTNode* s);
   void Visit(IncrPtr* s);
   void Visit(DecrPtr* s);
@@ -23,19 +24,19 @@ class ASTCodeGenVisitor : public ASTNodeVisitor {
   void Visit(BFLoop* s);
 
   llvm::Function* GetMain() { return main_; }
+  CodeGenABI& GetABI() { return abi_; }
   llvm::IRBuilder<> GetLastBuilder() { return builders_.top(); }
 
  private:
   void VisitNextASTNode(ASTNode* s);
   llvm::Module* module_;
   llvm::Value* ptr_;
-  llvm::Function* get_char_;
-  llvm::Function* put_char_;
+  CodeGenABI abi_;
   llvm::Function* main_;
   std::stack<llvm::IRBuilder<>> builders_;
 };
 
 llvm::Function* BuildProgramFromAST(ASTNode* s, llvm::Module* module,
-                                    int store_size);
+                                    const CodeGenOptions& options);
 
 #endif  // CODEGEN_AST
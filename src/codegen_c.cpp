@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "canon_ir.h"
+#include "codegen_c.h"
+
+static const int kCellModulus = 256;
+
+static int Wrap(int amt) {
+  return ((amt % kCellModulus) + kCellModulus) % kCellModulus;
+}
+
+// The amount as a signed cell value, so that -1 prints as -1 not 255
+static int Signed(int amt) {
+  int wrapped = Wrap(amt);
+  return wrapped >= kCellModulus / 2 ? wrapped - kCellModulus : wrapped;
+}
+
+static std::string Cell(int offset) {
+  std::stringstream ss;
+  if (offset == 0) {
+    ss << "*p";
+  } else {
+    ss << "p[" << offset << "]";
+  }
+  return ss.str();
+}
+
+static std::string CellPtr(int offset) {
+  std::stringstream ss;
+  ss << "p";
+  if (offset < 0) {
+    ss << " - " << -offset;
+  } else if (offset > 0) {
+    ss << " + " << offset;
+  }
+  return ss.str();
+}
+
+// Same as in codegen_canon.cpp
+static int InvertOdd(int n) {
+  int inverse = n;
+  // Each Newton step doubles the number of correct low bits
+  for (int i = 0; i < 3; i++) {
+    inverse = (inverse * (2 - n * inverse)) & 0xff;
+  }
+  return inverse;
+}
+
+CCodeGenVisitor::CCodeGenVisitor(std::ostream& out) : out_(out) {
+  indent_level_ = 1;
+  counter_depth_ = 0;
+}
+
+void CCodeGenVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  }
+}
+
+void CCodeGenVisitor::PrintLine(const std::string& s) {
+  for (int i = 0; i < indent_level_; i++) {
+    out_ << "  ";
+  }
+  out_ << s << "\n";
+}
+
+void CCodeGenVisitor::PrintBlock(const std::string& header, CNode* body) {
+  PrintLine(header + " {");
+  indent_level_++;
+  body->Accept(*this);
+  indent_level_--;
+  PrintLine("}");
+}
+
+void CCodeGenVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void CCodeGenVisitor::Visit(CPtrMov* n) {
+  std::stringstream ss;
+  if (n->GetAmt() < 0) {
+    ss << "p -= " << -n->GetAmt() << ";";
+  } else {
+    ss << "p += " << n->GetAmt() << ";";
+  }
+  PrintLine(ss.str());
+  VisitNextCNode(n);
+}
+
+void CCodeGenVisitor::Visit(CAdd* n) {
+  int amt = Signed(n->GetAmt());
+  std::stringstream ss;
+  if (amt < 0) {
+    ss << Cell(n->GetOffset()) << " -= " << -amt << ";";
+  } else {
+    ss << Cell(n->GetOffset()) << " += " << amt << ";";
+  }
+  PrintLine(ss.str());
+  VisitNextCNode(n);
+}
+
+void CCodeGenVisitor::Visit(CMul* n) {
+  int amt = Signed(n->GetAmt());
+  std::stringstream ss;
+  ss << Cell(n->GetTargetOffset()) << (amt < 0 ? " -= " : " += ")
+     << Cell(n->GetOpOffset());
+  if (amt != 1 && amt != -1) {
+    ss << " * " << (amt < 0 ? -amt : amt);
+  }
+  ss << ";";
+  PrintLine(ss.str());
+  VisitNextCNode(n);
+}
+
+void CCodeGenVisitor::Visit(CSet* n) {
+  std::stringstream ss;
+  ss << Cell(n->GetOffset()) << " = " << Wrap(n->GetAmt()) << ";";
+  PrintLine(ss.str());
+  VisitNextCNode(n);
+}
+
+void CCodeGenVisitor::Visit(CInput* n) {
+  PrintLine(Cell(n->GetOffset()) + " = getchar();");
+  VisitNextCNode(n);
+}
+
+void CCodeGenVisitor::Visit(COutput* n) {
+  PrintLine("putchar(" + Cell(n->GetOffset()) + ");");
+  VisitNextCNode(n);
+}
+
+void CCodeGenVisitor::Visit(CLoop* n) {
+  PrintBlock("while (*p)", n->GetBody());
+  VisitNextCNode(n);
+}
+
+void CCodeGenVisitor::Visit(CIf* n) {
+  PrintBlock("if (*p)", n->GetBody());
+  VisitNextCNode(n);
+}
+
+void CCodeGenVisitor::Visit(CCountedLoop* n) {
+  // The body takes the step itself, so the loop as written is exact; an
+  // odd step also gives the trip count as cell * -step^-1, which lets
+  // the compiler see a counted loop
+  int step = Wrap(n->GetStep());
+  if (step % 2 == 0) {
+    PrintBlock("while (*p)", n->GetBody());
+    VisitNextCNode(n);
+    return;
+  }
+  std::stringstream counter;
+  counter << "n" << counter_depth_;
+  std::stringstream ss;
+  ss << "for (unsigned char " << counter.str() << " = *p * "
+     << InvertOdd(kCellModulus - step) << "; " << counter.str() << "; "
+     << counter.str() << "--)";
+  counter_depth_++;
+  PrintBlock(ss.str(), n->GetBody());
+  counter_depth_--;
+  VisitNextCNode(n);
+}
+
+void CCodeGenVisitor::Visit(CDivMod* n) {
+  std::string quotient = Cell(n->GetQuotientOffset());
+  std::string remainder = Cell(n->GetRemainderOffset());
+  std::string temp = Cell(n->GetTempOffset());
+
+  if (n->HasDivisorCell()) {
+    // A divisor cell of 0 stands for 256, which still fits in an int
+    std::string divisor_cell = Cell(n->GetDivisorOffset());
+    std::string second_temp = Cell(n->GetSecondTempOffset());
+    PrintLine("if (" + remainder + " == 0 && " + temp + " == 0 && " +
+              second_temp + " == 0 && " + divisor_cell + " != 1) {");
+    indent_level_++;
+    PrintLine("int d = " + divisor_cell + " ? " + divisor_cell + " : 256;");
+    PrintLine(quotient + " += *p / d;");
+    PrintLine(remainder + " = *p % d;");
+    PrintLine(divisor_cell + " = d - " + remainder + ";");
+    PrintLine("*p = 0;");
+    indent_level_--;
+  } else {
+    std::stringstream divisor;
+    divisor << n->GetDivisor();
+    PrintLine("if (" + remainder + " == 0 && " + temp + " == 0) {");
+    indent_level_++;
+    PrintLine(quotient + " += *p / " + divisor.str() + ";");
+    PrintLine(remainder + " = *p % " + divisor.str() + ";");
+    PrintLine("*p = 0;");
+    indent_level_--;
+  }
+  PrintLine("} else {");
+  indent_level_++;
+  PrintBlock("while (*p)", n->GetBody());
+  indent_level_--;
+  PrintLine("}");
+  VisitNextCNode(n);
+}
+
+void CCodeGenVisitor::Visit(CSetRange* n) {
+  std::stringstream ss;
+  ss << "memset(" << CellPtr(n->GetOffset()) << ", " << Wrap(n->GetAmt())
+     << ", " << n->GetCount() << ");";
+  PrintLine(ss.str());
+  VisitNextCNode(n);
+}
+
+void CCodeGenVisitor::Visit(CMoveRange* n) {
+  int offset = n->GetOffset();
+  int count = n->GetCount();
+  int distance = n->GetDistance();
+  std::stringstream move;
+  move << "memmove(" << CellPtr(offset + distance) << ", " << CellPtr(offset)
+       << ", " << count << ");";
+  PrintLine(move.str());
+
+  // The cells the block left, at its start or end depending on direction
+  int vacated = std::min(std::abs(distance), count);
+  if (vacated > 0) {
+    int start = distance > 0 ? offset : offset + count - vacated;
+    std::stringstream clear;
+    clear << "memset(" << CellPtr(start) << ", 0, " << vacated << ");";
+    PrintLine(clear.str());
+  }
+  VisitNextCNode(n);
+}
+
+void PrintCProgram(CNode* n, std::ostream& out, int store_size) {
+  out << "#include <stdio.h>\n"
+      << "#include <string.h>\n"
+      << "\n"
+      << "static unsigned char tape[" << store_size << "];\n"
+      << "\n"
+      << "int main(void) {\n"
+      << "  unsigned char* p = tape;\n";
+  CCodeGenVisitor visitor(out);
+  if (n) {
+    n->Accept(visitor);
+  }
+  out << "  return 0;\n"
+      << "}\n";
+}
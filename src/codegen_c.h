@@ -0,0 +1,43 @@
+#ifndef CODEGEN_C
+#define CODEGEN_C
+
+#include <iostream>
+#include <string>
+
+#include "canon_ir.h"
+
+// Prints canonical IR as a standalone C program, reading with getchar
+// and writing with putchar like ABI_STANDALONE
+// Cells are addressed as offsets from a single data pointer, so a C
+// compiler sees the same straight-line updates the LLVM backend does
+class CCodeGenVisitor : public CNodeVisitor {
+ public:
+  CCodeGenVisitor(std::ostream& out);
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+ private:
+  void VisitNextCNode(CNode* n);
+  void PrintLine(const std::string& s);
+  // Prints {body} at the next indent level, after header
+  void PrintBlock(const std::string& header, CNode* body);
+  std::ostream& out_;
+  int indent_level_;
+  // Counted loops nest, so each level gets its own counter
+  int counter_depth_;
+};
+
+void PrintCProgram(CNode* n, std::ostream& out, int store_size);
+
+#endif  // CODEGEN_C
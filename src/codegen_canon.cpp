@@ -1,52 +1,118 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 #include <stack>
+#include <map>
+#include <string>
+#include <vector>
 #include <cassert>
 
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/DebugInfo.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/IRBuilder.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Support/Dwarf.h>
+#include <llvm/Support/Path.h>
 
 #include "canon_ir.h"
+#include "cell_access.h"
 #include "codegen_canon.h"
+#include "hash_cons.h"
 
 using namespace llvm;
 
-static Type* VOID_TYPE = Type::getVoidTy(getGlobalContext());
-static IntegerType* CELL_TYPE = IntegerType::get(getGlobalContext(), 8);
-static IntegerType* INDEX_TYPE = IntegerType::get(getGlobalContext(), 32);
-static PointerType* STORE_TYPE = PointerType::get(CELL_TYPE, 0);
-
-CNodeCodeGenVisitor::CNodeCodeGenVisitor(Module* module, int store_size) {
+// Vector lowering works on windows of at most this many cells
+static const int kVectorWidth = 16;
+// Windows with fewer updated cells than this are lowered to scalars
+static const unsigned kMinVectorCells = 3;
+// Loops touching more cells than this are left in memory
+static const unsigned kMaxPromotedCells = 32;
+// Profiled loops averaging fewer trips per entry than this are left in
+// memory, since promotion costs a load and store per cell on each entry
+static const uint64_t kMinPromotedTrips = 2;
+// Profiled loops averaging at least this many trips per entry are
+// unrolled kUnrollCount times
+static const uint64_t kMinUnrolledTrips = 16;
+static const int kUnrollCount = 4;
+
+CNodeCodeGenVisitor::CNodeCodeGenVisitor(Module* module,
+                                         const CodeGenOptions& options)
+    : abi_(module, options) {
   module_ = module;
-
-  // Define function for getting input
-  get_char_ =
-      cast<Function>(module_->getOrInsertFunction("getchar", CELL_TYPE, NULL));
-  get_char_->setCallingConv(CallingConv::C);
-
-  // Define function for printing
-  put_char_ = cast<Function>(
-      module_->getOrInsertFunction("putchar", VOID_TYPE, CELL_TYPE, NULL));
-  put_char_->setCallingConv(CallingConv::C);
-
-  // Define main function
-  main_ = cast<Function>(module_->getOrInsertFunction("main", VOID_TYPE, NULL));
-  main_->setCallingConv(CallingConv::C);
+  options_ = options;
+  // Out-of-steps returns from main, which an outlined loop can't do
+  if (options.count_steps) {
+    options_.outline_min_size = 0;
+  }
+  main_ = abi_.GetMain();
+  // Types come from the module's context, which need not be the global one
+  LLVMContext& context = module->getContext();
+  cell_type_ = IntegerType::get(context, 8);
+  index_type_ = IntegerType::get(context, 32);
+  bool_type_ = IntegerType::get(context, 1);
+  store_type_ = PointerType::get(cell_type_, 0);
+  vectorize_ = options.vectorize;
+  // Running out of steps returns mid-loop without writing promoted cells
+  // back, which BF_OUT_OF_STEPS allows
+  promote_cells_ = options.promote_cells;
+  promoting_ = false;
 
   // Push the main block onto a stack of loops
-  IRBuilder<> builder(BasicBlock::Create(getGlobalContext(), "code", main_));
+  IRBuilder<> builder(BasicBlock::Create(main_->getContext(), "code", main_));
   builders_.push(builder);
 
-  Value* store_size_v = ConstantInt::get(INDEX_TYPE, store_size);
+  // Allocate the data pointer
+  ptr_ = abi_.EmitPrologue(builder);
+  tape_ = ptr_;
+  static_position_ = true;
+  static_offset_ = 0;
+
+  debug_scope_ = nullptr;
+  if (options.debug_lines) {
+    StringRef name = sys::path::filename(options.debug_file);
+    StringRef directory = sys::path::parent_path(options.debug_file);
+    debug_builder_.reset(new DIBuilder(*module));
+    debug_builder_->createCompileUnit(dwarf::DW_LANG_C, name, directory,
+                                      "bfjit", true, "", 0);
+    DIFile file = debug_builder_->createFile(name, directory);
+    DICompositeType type = debug_builder_->createSubroutineType(
+        file, debug_builder_->getOrCreateTypeArray(None));
+    debug_scope_ = debug_builder_->createFunction(
+        file, main_->getName(), main_->getName(), file, 1, type, false, true,
+        1, 0, true, main_);
+    module->addModuleFlag(Module::Warning, "Debug Info Version",
+                          DEBUG_METADATA_VERSION);
+  }
+}
 
-  // Allocate the data pointer, an array of size store_size
-  ptr_ = builder.CreateAlloca(CELL_TYPE, store_size_v);
+void CNodeCodeGenVisitor::FinishDebugInfo() {
+  if (debug_builder_) {
+    debug_builder_->finalize();
+  }
+}
 
-  // Zero-out the data array
-  builder.CreateMemSet(ptr_, ConstantInt::get(CELL_TYPE, 0), store_size, 0);
+void CNodeCodeGenVisitor::SetDebugLine(CNode* s) {
+  if (!debug_builder_) {
+    return;
+  }
+  auto line = options_.debug_lines->find(s);
+  if (line == options_.debug_lines->end()) {
+    return;
+  }
+  DebugLoc loc = DebugLoc::get(line->second, 1, debug_scope_);
+  BasicBlock* block = builders_.top().GetInsertBlock();
+  for (auto inst = block->rbegin();
+       inst != block->rend() && inst->getDebugLoc().isUnknown(); ++inst) {
+    inst->setDebugLoc(loc);
+  }
 }
 
 void CNodeCodeGenVisitor::VisitNextCNode(CNode* s) {
+  SetDebugLine(s);
   CNode* next = s->GetNextCNode();
   if (next) {
     next->Accept(*this);
@@ -54,88 +120,560 @@ void CNodeCodeGenVisitor::VisitNextCNode(CNode* s) {
 }
 
 Value* CNodeCodeGenVisitor::GetPtrOffset(int offset) {
-  return ConstantInt::get(INDEX_TYPE, offset);
+  return ConstantInt::get(index_type_, offset);
 }
 
 Value* CNodeCodeGenVisitor::GetDataOffset(int offset) {
-  return ConstantInt::get(CELL_TYPE, offset);
+  return ConstantInt::get(cell_type_, offset);
 }
 
-void CNodeCodeGenVisitor::Visit(CNode* s) { VisitNextCNode(s); }
+Value* CNodeCodeGenVisitor::GetCellPtr(IRBuilder<>& builder, int offset) {
+  if (promoting_) {
+    auto it = promoted_.find(promoted_offset_ + offset);
+    assert(it != promoted_.end() && "cell missing from loop accesses");
+    return it->second;
+  }
+  if (static_position_) {
+    return builder.CreateGEP(tape_, GetPtrOffset(static_offset_ + offset));
+  }
+  return builder.CreateGEP(ptr_, GetPtrOffset(offset));
+}
 
-void CNodeCodeGenVisitor::Visit(CPtrMov* s) {
-  IRBuilder<> builder = builders_.top();
-  ptr_ = builder.CreateGEP(ptr_, GetPtrOffset(s->GetAmt()));
-  VisitNextCNode(s);
+bool CNodeCodeGenVisitor::BeginPromotion(CNode* body) {
+  if (!promote_cells_ || promoting_) {
+    return false;
+  }
+  const BodyAccess& access = GetBodyAccess(body, &access_cache_);
+  std::set<int> cells = access.reads;
+  cells.insert(access.writes.begin(), access.writes.end());
+  cells.insert(0);
+  if (!access.IsTracked() || cells.size() > kMaxPromotedCells) {
+    return false;
+  }
+  const LoopStats* stats = GetLoopStats(body);
+  if (stats && stats->trips < kMinPromotedTrips * stats->entries) {
+    return false;
+  }
+
+  // Every access in the loop is at a known offset from here, so each
+  // cell gets a stack slot that mem2reg turns into SSA values
+  BasicBlock& entry_block = main_->getEntryBlock();
+  IRBuilder<> entry_builder(&entry_block, entry_block.begin());
+  IRBuilder<>& builder = builders_.top();
+  for (int offset : cells) {
+    Value* slot = entry_builder.CreateAlloca(cell_type_);
+    builder.CreateStore(builder.CreateLoad(GetCellPtr(builder, offset)),
+                        slot);
+    promoted_[offset] = slot;
+  }
+  promoted_writes_ = access.writes;
+  promoted_base_ = ptr_;
+  promoted_offset_ = 0;
+  promoting_ = true;
+
+  // Vector windows would span cells that now live apart
+  saved_vectorize_ = vectorize_;
+  vectorize_ = false;
+  return true;
 }
 
-void CNodeCodeGenVisitor::Visit(CAdd* s) {
-  IRBuilder<> builder = builders_.top();
+void CNodeCodeGenVisitor::EndPromotion() {
+  promoting_ = false;
+  vectorize_ = saved_vectorize_;
+
+  // Write back only the cells the loop may have changed
+  IRBuilder<>& builder = builders_.top();
+  for (int offset : promoted_writes_) {
+    Value* cell_ptr = builder.CreateGEP(promoted_base_, GetPtrOffset(offset));
+    builder.CreateStore(builder.CreateLoad(promoted_[offset]), cell_ptr);
+  }
+  promoted_.clear();
+  promoted_writes_.clear();
+}
+
+Value* CNodeCodeGenVisitor::GetVectorPtr(IRBuilder<>& builder, int offset,
+                                         int width) {
+  Type* vector_type = VectorType::get(cell_type_, width);
+  return builder.CreateBitCast(GetCellPtr(builder, offset),
+                               PointerType::get(vector_type, 0));
+}
+
+// Splits sorted offsets into windows spanning at most kVectorWidth cells
+static std::vector<std::vector<int>> GroupOffsets(
+    const std::vector<int>& offsets) {
+  std::vector<std::vector<int>> groups;
+  for (int offset : offsets) {
+    if (groups.empty() || offset - groups.back().front() >= kVectorWidth) {
+      groups.push_back(std::vector<int>());
+    }
+    groups.back().push_back(offset);
+  }
+  return groups;
+}
+
+CNode* CNodeCodeGenVisitor::EmitUpdateRun(CNode* s) {
+  // Adds and sets in a row only interact when they hit the same cell,
+  // so merge them per cell first
+  std::map<int, CellUpdate> updates;
+  CNode* last = s;
+  for (CNode* n = s; n; n = n->GetNextCNode()) {
+    if (CAdd* add = dynamic_cast<CAdd*>(n)) {
+      updates[add->GetOffset()].amt += add->GetAmt();
+    } else if (CSet* set = dynamic_cast<CSet*>(n)) {
+      CellUpdate& update = updates[set->GetOffset()];
+      update.is_set = true;
+      update.amt = set->GetAmt();
+    } else {
+      break;
+    }
+    last = n;
+    if (!vectorize_) {
+      break;
+    }
+  }
+
+  std::vector<int> offsets;
+  for (auto& pair : updates) {
+    if (pair.second.is_set || pair.second.amt != 0) {
+      offsets.push_back(pair.first);
+    }
+  }
+
+  for (auto& group : GroupOffsets(offsets)) {
+    if (group.size() >= kMinVectorCells) {
+      EmitVectorUpdate(group.front(), group.back() - group.front() + 1,
+                       updates);
+      continue;
+    }
+    for (int offset : group) {
+      CellUpdate& update = updates[offset];
+      if (update.is_set) {
+        EmitSet(offset, update.amt);
+      } else {
+        EmitAdd(offset, update.amt);
+      }
+    }
+  }
+  return last;
+}
+
+void CNodeCodeGenVisitor::EmitVectorUpdate(
+    int offset, int width, const std::map<int, CellUpdate>& updates) {
+  IRBuilder<>& builder = builders_.top();
+
+  // Lanes not in updates are loaded and stored back unchanged
+  // They lie between two updated cells, so this never touches memory
+  // outside what the scalar code would
+  std::vector<Constant*> adds, sets, mask;
+  bool any_set = false;
+  bool all_set = true;
+  for (int lane = 0; lane < width; lane++) {
+    auto it = updates.find(offset + lane);
+    bool is_set = it != updates.end() && it->second.is_set;
+    int amt = it != updates.end() ? it->second.amt : 0;
+    adds.push_back(ConstantInt::get(cell_type_, is_set ? 0 : amt));
+    sets.push_back(ConstantInt::get(cell_type_, is_set ? amt : 0));
+    mask.push_back(ConstantInt::get(bool_type_, is_set));
+    any_set |= is_set;
+    all_set &= is_set;
+  }
+
+  Value* vector_ptr = GetVectorPtr(builder, offset, width);
+  Value* result;
+  if (all_set) {
+    result = ConstantVector::get(sets);
+  } else {
+    Value* cells = builder.CreateAlignedLoad(vector_ptr, 1);
+    result = builder.CreateAdd(cells, ConstantVector::get(adds));
+    if (any_set) {
+      result = builder.CreateSelect(ConstantVector::get(mask),
+                                    ConstantVector::get(sets), result);
+    }
+  }
+  builder.CreateAlignedStore(result, vector_ptr, 1);
+}
+
+CNode* CNodeCodeGenVisitor::EmitMulRun(CMul* s) {
+  // Multiplies from the same source fan out to independent cells,
+  // as long as none of them writes the source
+  int op_offset = s->GetOpOffset();
+  std::map<int, int> factors;
+  CNode* last = s;
+  for (CNode* n = s; n; n = n->GetNextCNode()) {
+    CMul* mul = dynamic_cast<CMul*>(n);
+    if (!mul || mul->GetOpOffset() != op_offset ||
+        mul->GetTargetOffset() == op_offset) {
+      break;
+    }
+    factors[mul->GetTargetOffset()] += mul->GetAmt();
+    last = n;
+    if (!vectorize_) {
+      break;
+    }
+  }
+
+  IRBuilder<>& builder = builders_.top();
+  if (factors.empty()) {
+    Value* op_val = builder.CreateLoad(GetCellPtr(builder, op_offset));
+    EmitMul(op_val, s->GetTargetOffset(), s->GetAmt());
+    return s;
+  }
+
+  Value* op_val = builder.CreateLoad(GetCellPtr(builder, op_offset));
+  std::vector<int> targets;
+  for (auto& pair : factors) {
+    targets.push_back(pair.first);
+  }
+
+  for (auto& group : GroupOffsets(targets)) {
+    if (group.size() < kMinVectorCells) {
+      for (int target : group) {
+        EmitMul(op_val, target, factors[target]);
+      }
+      continue;
+    }
+
+    int offset = group.front();
+    int width = group.back() - offset + 1;
+    std::vector<Constant*> lane_factors;
+    for (int lane = 0; lane < width; lane++) {
+      auto it = factors.find(offset + lane);
+      int amt = it != factors.end() ? it->second : 0;
+      lane_factors.push_back(ConstantInt::get(cell_type_, amt));
+    }
+
+    Value* vector_ptr = GetVectorPtr(builder, offset, width);
+    Value* cells = builder.CreateAlignedLoad(vector_ptr, 1);
+    Value* op_vector = builder.CreateVectorSplat(width, op_val);
+    Value* product =
+        builder.CreateMul(op_vector, ConstantVector::get(lane_factors));
+    builder.CreateAlignedStore(builder.CreateAdd(cells, product), vector_ptr,
+                               1);
+  }
+  return last;
+}
+
+void CNodeCodeGenVisitor::EmitAdd(int offset, int amt) {
+  IRBuilder<>& builder = builders_.top();
 
-  Value* offset_ptr = builder.CreateGEP(ptr_, GetPtrOffset(s->GetOffset()));
+  Value* offset_ptr = GetCellPtr(builder, offset);
   Value* offset_val = builder.CreateLoad(offset_ptr);
 
-  Value* add_val = GetDataOffset(s->GetAmt());
+  Value* add_val = GetDataOffset(amt);
   Value* result = builder.CreateAdd(offset_val, add_val);
 
   builder.CreateStore(result, offset_ptr);
-  VisitNextCNode(s);
 }
 
-void CNodeCodeGenVisitor::Visit(CMul* s) {
-  IRBuilder<> builder = builders_.top();
+void CNodeCodeGenVisitor::EmitMul(Value* op_val, int target_offset, int amt) {
+  IRBuilder<>& builder = builders_.top();
 
-  int op_offset = s->GetOpOffset();
-  int target_offset = s->GetTargetOffset();
-  int amt = s->GetAmt();
-
-  Value* op_offset_ptr = builder.CreateGEP(ptr_, GetPtrOffset(op_offset));
-  Value* target_offset_ptr =
-      builder.CreateGEP(ptr_, GetPtrOffset(target_offset));
+  Value* target_offset_ptr = GetCellPtr(builder, target_offset);
   Value* mul_val = GetDataOffset(amt);
 
-  Value* op_val = builder.CreateLoad(op_offset_ptr);
   Value* target_val = builder.CreateLoad(target_offset_ptr);
   Value* mul_result = builder.CreateMul(op_val, mul_val);
   Value* add_result = builder.CreateAdd(target_val, mul_result);
 
   builder.CreateStore(add_result, target_offset_ptr);
-  VisitNextCNode(s);
 }
 
-void CNodeCodeGenVisitor::Visit(CSet* s) {
-  IRBuilder<> builder = builders_.top();
+void CNodeCodeGenVisitor::EmitSet(int offset, int amt) {
+  IRBuilder<>& builder = builders_.top();
 
-  Value* offset_ptr = builder.CreateGEP(ptr_, GetPtrOffset(s->GetOffset()));
-  Value* set_val = GetDataOffset(s->GetAmt());
+  Value* offset_ptr = GetCellPtr(builder, offset);
+  Value* set_val = GetDataOffset(amt);
   builder.CreateStore(set_val, offset_ptr);
+}
+
+void CNodeCodeGenVisitor::Visit(CNode* s) { VisitNextCNode(s); }
+
+void CNodeCodeGenVisitor::Visit(CPtrMov* s) {
+  IRBuilder<> builder = builders_.top();
+  if (static_position_) {
+    // Address from the start of the tape rather than chaining GEPs
+    static_offset_ += s->GetAmt();
+    ptr_ = builder.CreateGEP(tape_, GetPtrOffset(static_offset_));
+  } else {
+    ptr_ = builder.CreateGEP(ptr_, GetPtrOffset(s->GetAmt()));
+  }
+  promoted_offset_ += s->GetAmt();
   VisitNextCNode(s);
 }
 
+void CNodeCodeGenVisitor::Visit(CAdd* s) { VisitNextCNode(EmitUpdateRun(s)); }
+
+void CNodeCodeGenVisitor::Visit(CMul* s) { VisitNextCNode(EmitMulRun(s)); }
+
+void CNodeCodeGenVisitor::Visit(CSet* s) { VisitNextCNode(EmitUpdateRun(s)); }
+
 void CNodeCodeGenVisitor::Visit(CInput* s) {
-  IRBuilder<> builder = builders_.top();
+  IRBuilder<>& builder = builders_.top();
 
-  Value* ptr_offset = builder.CreateGEP(ptr_, GetPtrOffset(s->GetOffset()));
-  Value* input = builder.CreateCall(get_char_);
+  Value* ptr_offset = GetCellPtr(builder, s->GetOffset());
+  Value* input = abi_.EmitInput(builder);
 
   builder.CreateStore(input, ptr_offset);
   VisitNextCNode(s);
 }
 
 void CNodeCodeGenVisitor::Visit(COutput* s) {
-  IRBuilder<> builder = builders_.top();
+  IRBuilder<>& builder = builders_.top();
 
-  Value* offset_ptr = builder.CreateGEP(ptr_, GetPtrOffset(s->GetOffset()));
+  Value* offset_ptr = GetCellPtr(builder, s->GetOffset());
   Value* ptr_value = builder.CreateLoad(offset_ptr);
 
-  builder.CreateCall(put_char_, ptr_value);
+  abi_.EmitOutput(builder, ptr_value);
   VisitNextCNode(s);
 }
 
 void CNodeCodeGenVisitor::Visit(CLoop* s) {
+  if (!EmitOutlinedLoop(s->GetBody())) {
+    bool promoted = BeginPromotion(s->GetBody());
+    EmitLoop(s->GetBody());
+    if (promoted) {
+      EndPromotion();
+    }
+  }
+  VisitNextCNode(s);
+}
+
+void CNodeCodeGenVisitor::Visit(CIf* s) {
+  BasicBlock* body_block = BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* post_block = BasicBlock::Create(main_->getContext(), "", main_);
+  Value* entry_ptr = ptr_;
+
+  // A single forward branch, with no back-edge or pointer phis
+  IRBuilder<>& builder = builders_.top();
+  Value* cond =
+      builder.CreateIsNotNull(builder.CreateLoad(GetCellPtr(builder, 0)));
+  builder.CreateCondBr(cond, body_block, post_block);
+
+  builder.SetInsertPoint(body_block);
+  s->GetBody()->Accept(*this);
+  builders_.top().CreateBr(post_block);
+  builders_.top().SetInsertPoint(post_block);
+
+  // The body is balanced, so both paths leave the pointer where it was
+  ptr_ = entry_ptr;
+  VisitNextCNode(s);
+}
+
+// Inverse of an odd number modulo the cell size
+static int InvertOdd(int n) {
+  int inverse = n;
+  // Each Newton step doubles the number of correct low bits
+  for (int i = 0; i < 3; i++) {
+    inverse = (inverse * (2 - n * inverse)) & 0xff;
+  }
+  return inverse;
+}
+
+void CNodeCodeGenVisitor::Visit(CCountedLoop* s) {
+  BasicBlock* count_block = BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* body_block = BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* post_block = BasicBlock::Create(main_->getContext(), "", main_);
+  Value* entry_ptr = ptr_;
+
+  // Solve cell + trips * step == 0 modulo the cell size
+  // With step = 2^shift * odd, zero is only reached from a multiple of
+  // 2^shift, and then trips = (cell >> shift) * -odd^-1
+  int step = s->GetStep();
+  int shift = 0;
+  while (((step >> shift) & 1) == 0) {
+    shift++;
+  }
+  int inverse = InvertOdd((256 - step) >> shift);
+  int trips_mask = (256 >> shift) - 1;
+
+  bool promoted = BeginPromotion(s->GetBody());
+  IRBuilder<>& builder = builders_.top();
+  Value* cell = builder.CreateLoad(GetCellPtr(builder, 0));
+  if (shift > 0) {
+    // Any other start never reaches zero, so run the loop as written
+    BasicBlock* endless_block =
+        BasicBlock::Create(main_->getContext(), "", main_);
+    Value* low_bits = builder.CreateAnd(cell, (1 << shift) - 1);
+    builder.CreateCondBr(builder.CreateIsNull(low_bits), count_block,
+                         endless_block);
+    builder.SetInsertPoint(endless_block);
+    EmitLoop(s->GetBody());
+    builders_.top().CreateBr(post_block);
+    ptr_ = entry_ptr;
+  } else {
+    builder.CreateBr(count_block);
+  }
+
+  IRBuilder<>& count_builder = builders_.top();
+  count_builder.SetInsertPoint(count_block);
+  Value* trips = count_builder.CreateZExt(cell, index_type_);
+  trips = count_builder.CreateLShr(trips, shift);
+  trips = count_builder.CreateMul(trips, GetPtrOffset(inverse));
+  trips = count_builder.CreateAnd(trips, trips_mask);
+  // Every back-edge is paid for up front, so the latch has no check
+  abi_.EmitCharge(count_builder,
+                  count_builder.CreateZExt(trips, count_builder.getInt64Ty()));
+  BasicBlock* entry_block = count_builder.GetInsertBlock();
+  count_builder.CreateCondBr(count_builder.CreateIsNotNull(trips), body_block,
+                             post_block);
+
+  // Count down from the trip count; the body is balanced, so the pointer
+  // needs no phi
+  count_builder.SetInsertPoint(body_block);
+  PHINode* remaining = count_builder.CreatePHI(index_type_, 2);
+  remaining->addIncoming(trips, entry_block);
+  s->GetBody()->Accept(*this);
+
+  // Body could have progressed to a new block
+  IRBuilder<>& latch_builder = builders_.top();
+  Value* next = latch_builder.CreateSub(remaining, GetPtrOffset(1));
+  remaining->addIncoming(next, latch_builder.GetInsertBlock());
+  latch_builder.CreateCondBr(latch_builder.CreateIsNotNull(next), body_block,
+                             post_block);
+  latch_builder.SetInsertPoint(post_block);
+
+  ptr_ = entry_ptr;
+  if (promoted) {
+    EndPromotion();
+  }
+  VisitNextCNode(s);
+}
+
+void CNodeCodeGenVisitor::Visit(CDivMod* s) {
+  BasicBlock* fast_block = BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* slow_block = BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* done_block = BasicBlock::Create(main_->getContext(), "", main_);
+  Value* entry_ptr = ptr_;
+
+  // The closed form only holds with the remainder and temporaries clear
+  IRBuilder<>& builder = builders_.top();
+  Value* remainder_ptr = GetCellPtr(builder, s->GetRemainderOffset());
+  Value* temp_ptr = GetCellPtr(builder, s->GetTempOffset());
+  Value* clear =
+      builder.CreateAnd(builder.CreateIsNull(builder.CreateLoad(remainder_ptr)),
+                        builder.CreateIsNull(builder.CreateLoad(temp_ptr)));
+  Value* divisor_ptr = nullptr;
+  Value* divisor_cell = nullptr;
+  if (s->HasDivisorCell()) {
+    Value* second_temp_ptr = GetCellPtr(builder, s->GetSecondTempOffset());
+    clear = builder.CreateAnd(
+        clear, builder.CreateIsNull(builder.CreateLoad(second_temp_ptr)));
+    // A divisor of 1 sends the loop off the end of the idiom
+    divisor_ptr = GetCellPtr(builder, s->GetDivisorOffset());
+    divisor_cell = builder.CreateLoad(divisor_ptr);
+    clear = builder.CreateAnd(
+        clear, builder.CreateICmpNE(divisor_cell, GetDataOffset(1)));
+  }
+  builder.CreateCondBr(clear, fast_block, slow_block);
+
+  builder.SetInsertPoint(fast_block);
+  Value* cell_ptr = GetCellPtr(builder, 0);
+  Value* quotient_ptr = GetCellPtr(builder, s->GetQuotientOffset());
+  Value* cell = builder.CreateLoad(cell_ptr);
+  Value* quotient;
+  Value* remainder;
+  if (s->HasDivisorCell()) {
+    // A divisor cell of 0 stands for 256, so divide in a wider type
+    Value* wide_cell = builder.CreateZExt(cell, index_type_);
+    Value* divisor = builder.CreateSelect(
+        builder.CreateIsNull(divisor_cell), GetPtrOffset(256),
+        builder.CreateZExt(divisor_cell, index_type_));
+    quotient = builder.CreateTrunc(builder.CreateUDiv(wide_cell, divisor),
+                                   cell_type_);
+    remainder = builder.CreateTrunc(builder.CreateURem(wide_cell, divisor),
+                                    cell_type_);
+    builder.CreateStore(builder.CreateSub(divisor_cell, remainder),
+                        divisor_ptr);
+  } else {
+    Value* divisor = GetDataOffset(s->GetDivisor());
+    quotient = builder.CreateUDiv(cell, divisor);
+    remainder = builder.CreateURem(cell, divisor);
+  }
+  builder.CreateStore(
+      builder.CreateAdd(builder.CreateLoad(quotient_ptr), quotient),
+      quotient_ptr);
+  builder.CreateStore(remainder, remainder_ptr);
+  builder.CreateStore(GetDataOffset(0), cell_ptr);
+  builder.CreateBr(done_block);
+
+  // Otherwise run the original loop
+  builder.SetInsertPoint(slow_block);
+  EmitLoop(s->GetBody());
+  BasicBlock* slow_end_block = builders_.top().GetInsertBlock();
+  builders_.top().CreateBr(done_block);
+  builders_.top().SetInsertPoint(done_block);
+
+  // A balanced loop leaves the pointer where it was, like the closed form
+  if (!GetBodyAccess(s->GetBody(), &access_cache_).IsBalanced()) {
+    PHINode* phi = builders_.top().CreatePHI(store_type_, 2);
+    phi->addIncoming(entry_ptr, fast_block);
+    phi->addIncoming(ptr_, slow_end_block);
+    ptr_ = phi;
+  } else {
+    ptr_ = entry_ptr;
+  }
+  VisitNextCNode(s);
+}
+
+void CNodeCodeGenVisitor::Visit(CSetRange* s) {
+  if (promoting_) {
+    // Promoted cells live in separate slots
+    for (int i = 0; i < s->GetCount(); i++) {
+      EmitSet(s->GetOffset() + i, s->GetAmt());
+    }
+  } else {
+    IRBuilder<>& builder = builders_.top();
+    builder.CreateMemSet(GetCellPtr(builder, s->GetOffset()),
+                         GetDataOffset(s->GetAmt()), s->GetCount(), 1);
+  }
+  VisitNextCNode(s);
+}
+
+void CNodeCodeGenVisitor::Visit(CMoveRange* s) {
+  IRBuilder<>& builder = builders_.top();
+  int offset = s->GetOffset();
+  int count = s->GetCount();
+  int distance = s->GetDistance();
+  // The cells the block left, at its start or end depending on direction
+  int vacated = std::min(std::abs(distance), count);
+  int vacated_start = distance > 0 ? offset : offset + count - vacated;
+
+  if (promoting_) {
+    std::vector<Value*> moved;
+    for (int i = 0; i < count; i++) {
+      moved.push_back(builder.CreateLoad(GetCellPtr(builder, offset + i)));
+    }
+    for (int i = 0; i < vacated; i++) {
+      EmitSet(vacated_start + i, 0);
+    }
+    for (int i = 0; i < count; i++) {
+      builder.CreateStore(moved[i],
+                          GetCellPtr(builder, offset + distance + i));
+    }
+  } else {
+    builder.CreateMemMove(GetCellPtr(builder, offset + distance),
+                          GetCellPtr(builder, offset), count, 1);
+    if (vacated > 0) {
+      builder.CreateMemSet(GetCellPtr(builder, vacated_start),
+                           GetDataOffset(0), vacated, 1);
+    }
+  }
+  VisitNextCNode(s);
+}
+
+void CNodeCodeGenVisitor::EmitLoop(CNode* body) {
+  // A balanced body leaves the pointer where it found it, so the pointer
+  // needs no phis and stays loop-invariant
+  const BodyAccess& access = GetBodyAccess(body, &access_cache_);
+  bool balanced = access.IsBalanced();
+  // A moving body can't loop forever by itself, so its trips are charged
+  // together once the loop exits, from how far the pointer went
+  bool charge_on_exit = options_.count_steps && access.IsMoving();
+  Value* entry_ptr = ptr_;
+
   // Create basic blocks for condition, body, and after
-  BasicBlock* body_block = BasicBlock::Create(getGlobalContext(), "", main_);
-  BasicBlock* post_block = BasicBlock::Create(getGlobalContext(), "", main_);
+  BasicBlock* body_block = BasicBlock::Create(main_->getContext(), "", main_);
+  BasicBlock* post_block = BasicBlock::Create(main_->getContext(), "", main_);
 
   // Make builders for each block
   IRBuilder<> curr_builder = builders_.top();
@@ -144,43 +682,71 @@ void CNodeCodeGenVisitor::Visit(CLoop* s) {
 
   BasicBlock* curr_block = curr_builder.GetInsertBlock();
 
+  // Each entry runs the body at least once or not at all, so at most
+  // trips of the entries go in and the rest of the trips loop back
+  const LoopStats* stats = GetLoopStats(body);
+  MDNode* entry_weights = nullptr;
+  MDNode* latch_weights = nullptr;
+  if (stats) {
+    uint64_t entered = std::min(stats->entries, stats->trips);
+    entry_weights = GetBranchWeights(entered, stats->entries - entered);
+    latch_weights = GetBranchWeights(stats->trips - entered, entered);
+  }
+
   // Conditionally jump into the body or to the post block
-  Value* ptr_value = curr_builder.CreateLoad(ptr_);
+  Value* ptr_value = curr_builder.CreateLoad(GetCellPtr(curr_builder, 0));
   Value* cond = curr_builder.CreateIsNotNull(ptr_value);
-  curr_builder.CreateCondBr(cond, body_block, post_block);
+  curr_builder.CreateCondBr(cond, body_block, post_block, entry_weights);
 
   // Current block is now done
   builders_.pop();
 
-  // Create a phi node in the body for the ptr
-  PHINode* body_phi = body_builder.CreatePHI(STORE_TYPE, 2);
-  body_phi->addIncoming(ptr_, curr_block);
+  PHINode* body_phi = nullptr;
+  PHINode* post_phi = nullptr;
+  if (!balanced) {
+    // Create a phi node in the body for the ptr
+    body_phi = body_builder.CreatePHI(store_type_, 2);
+    body_phi->addIncoming(ptr_, curr_block);
+
+    // Create a phi node in the post block for the ptr
+    post_phi = post_builder.CreatePHI(store_type_, 2);
+    post_phi->addIncoming(ptr_, curr_block);
+
+    // Set the pointer in the body to the phi node
+    ptr_ = body_phi;
 
-  // Create a phi node in the post block for the ptr
-  PHINode* post_phi = post_builder.CreatePHI(STORE_TYPE, 2);
-  post_phi->addIncoming(ptr_, curr_block);
+    // From here on the position depends on the data
+    static_position_ = false;
+  }
 
   // Set the loop body as our current block
   builders_.push(body_builder);
 
-  // Set the pointer in the body to the phi node
-  ptr_ = body_phi;
-
   // Process the loop body
-  s->GetBody()->Accept(*this);
+  body->Accept(*this);
 
   // Body could have progressed to a new block
-  IRBuilder<> new_body_builder = builders_.top();
+  IRBuilder<>& new_body_builder = builders_.top();
+  if (!charge_on_exit) {
+    abi_.EmitBackEdge(new_body_builder);
+  }
   BasicBlock* new_body_block = new_body_builder.GetInsertBlock();
 
   // Create a conditional branch to restart the loop
-  ptr_value = new_body_builder.CreateLoad(ptr_);
+  ptr_value = new_body_builder.CreateLoad(GetCellPtr(new_body_builder, 0));
   cond = new_body_builder.CreateIsNotNull(ptr_value);
-  new_body_builder.CreateCondBr(cond, body_block, post_block);
+  BranchInst* latch =
+      new_body_builder.CreateCondBr(cond, body_block, post_block,
+                                    latch_weights);
+  if (stats) {
+    latch->setMetadata("llvm.loop", GetUnrollMetadata(*stats));
+  }
 
   // Update phi nodes
-  body_phi->addIncoming(ptr_, new_body_block);
-  post_phi->addIncoming(ptr_, new_body_block);
+  if (!balanced) {
+    body_phi->addIncoming(ptr_, new_body_block);
+    post_phi->addIncoming(ptr_, new_body_block);
+  }
 
   // Body block is now done
   builders_.pop();
@@ -189,18 +755,113 @@ void CNodeCodeGenVisitor::Visit(CLoop* s) {
   builders_.push(post_builder);
 
   // Set the pointer to the phi node
-  ptr_ = post_phi;
+  ptr_ = balanced ? entry_ptr : post_phi;
+
+  if (charge_on_exit) {
+    IRBuilder<>& builder = builders_.top();
+    Value* distance = builder.CreatePtrDiff(post_phi, entry_ptr);
+    Value* trips = builder.CreateExactSDiv(
+        distance, ConstantInt::get(distance->getType(), access.ptr_mov));
+    abi_.EmitCharge(builder, trips);
+  }
+}
 
-  // Visist the rest of the program
-  VisitNextCNode(s);
+const LoopStats* CNodeCodeGenVisitor::GetLoopStats(CNode* body) {
+  if (!options_.loop_profile) {
+    return nullptr;
+  }
+  auto it = options_.loop_profile->find(body);
+  return it == options_.loop_profile->end() ? nullptr : &it->second;
+}
+
+MDNode* CNodeCodeGenVisitor::GetBranchWeights(uint64_t taken,
+                                              uint64_t not_taken) {
+  // Weights are 32 bits, so scale both down until the larger one fits
+  uint64_t scale = std::max(taken, not_taken) / UINT32_MAX + 1;
+  return MDBuilder(main_->getContext())
+      .createBranchWeights(taken / scale, not_taken / scale);
+}
+
+MDNode* CNodeCodeGenVisitor::GetUnrollMetadata(const LoopStats& stats) {
+  LLVMContext& context = main_->getContext();
+  std::vector<Metadata*> hint;
+  if (stats.trips >= kMinUnrolledTrips * stats.entries && stats.entries) {
+    hint.push_back(MDString::get(context, "llvm.loop.unroll.count"));
+    hint.push_back(
+        ConstantAsMetadata::get(ConstantInt::get(index_type_, kUnrollCount)));
+  } else {
+    hint.push_back(MDString::get(context, "llvm.loop.unroll.disable"));
+  }
+
+  // A loop ID refers to itself, through a placeholder until it exists
+  MDNode* placeholder = MDNode::getTemporary(context, None);
+  Metadata* ops[] = {placeholder, MDNode::get(context, hint)};
+  MDNode* loop_id = MDNode::get(context, ops);
+  loop_id->replaceOperandWith(0, loop_id);
+  MDNode::deleteTemporary(placeholder);
+  return loop_id;
+}
+
+void CNodeCodeGenVisitor::CountLoops(CNode* n) {
+  access_cache_.clear();
+  loop_keys_.ForgetNodes();
+  LoopCountVisitor counter(&loop_keys_);
+  n->Accept(counter);
+  for (auto& pair : counter.GetCounts()) {
+    loop_counts_[pair.first] += pair.second;
+  }
+}
+
+bool CNodeCodeGenVisitor::EmitOutlinedLoop(CNode* body) {
+  // Promoted cells live in this function's stack slots
+  if (options_.outline_min_size == 0 || promoting_) {
+    return false;
+  }
+  const LoopKey& key = loop_keys_.GetKey(body);
+  if (key.has_io || key.size < options_.outline_min_size ||
+      loop_counts_[key.key] < 2) {
+    return false;
+  }
+
+  // The first site emits the loop as char* bf_loopN(char* ptr)
+  Function*& func = outlined_[key.key];
+  if (!func) {
+    CodeGenOptions options = options_;
+    options.abi = ABI_REGION;
+    options.region_name = "bf_loop" + std::to_string(outlined_.size());
+    options.outline_min_size = 0;
+    options.debug_lines = nullptr;
+    CNodeCodeGenVisitor outlined(module_, options);
+    bool promoted = outlined.BeginPromotion(body);
+    outlined.EmitLoop(body);
+    if (promoted) {
+      outlined.EndPromotion();
+    }
+    IRBuilder<> builder = outlined.GetLastBuilder();
+    outlined.GetABI().EmitReturn(builder, outlined.GetPtr());
+    func = outlined.GetMain();
+    if (!options_.debug_lines) {
+      func->setLinkage(GlobalValue::InternalLinkage);
+    }
+  }
+
+  IRBuilder<>& builder = builders_.top();
+  Value* post_ptr = builder.CreateCall(func, ptr_);
+  if (!GetBodyAccess(body, &access_cache_).IsBalanced()) {
+    ptr_ = post_ptr;
+    static_position_ = false;
+  }
+  return true;
 }
 
 Function* BuildProgramFromCanon(CNode* s, llvm::Module* module,
-                                int store_size) {
-  CNodeCodeGenVisitor visitor(module, store_size);
+                                const CodeGenOptions& options) {
+  CNodeCodeGenVisitor visitor(module, options);
+  visitor.CountLoops(s);
   s->Accept(visitor);
   IRBuilder<> builder = visitor.GetLastBuilder();
-  builder.CreateRetVoid();
+  visitor.GetABI().EmitReturn(builder);
+  visitor.FinishDebugInfo();
   Function* func = visitor.GetMain();
   return func;
 }
@@ -2,17 +2,31 @@
 #define CODEGEN_CANON
 
 #include <stack>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
 
+#include "llvm/IR/DIBuilder.h"
 #include "llvm/IR/DerivedTypes.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 
+#include "codegen_abi.h"
 #include "canon_ir.h"
+#include "cell_access.h"
+#include "hash_cons.h"
+
+// Pending update to one cell from a run of CAdds and CSets
+struct CellUpdate {
+  bool is_set = false;
+  int amt = 0;
+};
 
 class CNodeCodeGenVisitor : public CNodeVisitor {
  public:
-  CNodeCodeGenVisitor(llvm::Module* module, int store_size);
+  CNodeCodeGenVisitor(llvm::Module* module, const CodeGenOptions& options);
   void Visit(CNode* n);
   void Visit(CPtrMov* n);
   void Visit(CAdd* n);
@@ -21,22 +35,90 @@ class CNodeCodeGenVisitor : public CNodeVisitor {
   void Visit(CInput* n);
   void Visit(COutput* n);
   void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
 
   llvm::Function* GetMain() { return main_; }
+  CodeGenABI& GetABI() { return abi_; }
   llvm::IRBuilder<> GetLastBuilder() { return builders_.top(); }
+  // The data pointer after the last node visited
+  llvm::Value* GetPtr() { return ptr_; }
+  // Counts the loops in n, so that repeats among everything counted so
+  // far can be outlined
+  // Nodes from earlier calls may have been freed, so only n's loops are
+  // visited afterwards
+  void CountLoops(CNode* n);
+  // Completes the debug info, once every node has been visited
+  void FinishDebugInfo();
 
  private:
   void VisitNextCNode(CNode* s);
+  // Gives s's line to the instructions at the end of the current block
+  // that have no location yet
+  void SetDebugLine(CNode* s);
   llvm::Value* GetPtrOffset(int offset);
   llvm::Value* GetDataOffset(int offset);
+  llvm::Value* GetCellPtr(llvm::IRBuilder<>& builder, int offset);
+  llvm::Value* GetVectorPtr(llvm::IRBuilder<>& builder, int offset, int width);
+  // Lower the run of nodes starting at s, grouping nearby cells into
+  // vector operations; return the last node lowered
+  CNode* EmitUpdateRun(CNode* s);
+  CNode* EmitMulRun(CMul* s);
+  void EmitVectorUpdate(int offset, int width,
+                        const std::map<int, CellUpdate>& updates);
+  void EmitAdd(int offset, int amt);
+  void EmitMul(llvm::Value* op_val, int target_offset, int amt);
+  void EmitSet(int offset, int amt);
+  // Emits while(*ptr) {body}, leaving the builder after the loop
+  void EmitLoop(CNode* body);
+  // Profile counts for the CLoop with this body, or nullptr
+  const LoopStats* GetLoopStats(CNode* body);
+  llvm::MDNode* GetBranchWeights(uint64_t taken, uint64_t not_taken);
+  // Unrolls hot loops and keeps the rest rolled
+  llvm::MDNode* GetUnrollMetadata(const LoopStats& stats);
+  // Emits a call to the shared function for a repeated loop, returning
+  // false if the loop should be emitted inline
+  bool EmitOutlinedLoop(CNode* body);
+  // Keeps the cells a balanced loop touches in registers until
+  // EndPromotion, returning false if the loop does not qualify
+  bool BeginPromotion(CNode* body);
+  void EndPromotion();
   llvm::Module* module_;
+  llvm::IntegerType* cell_type_;
+  llvm::IntegerType* index_type_;
+  llvm::IntegerType* bool_type_;
+  llvm::PointerType* store_type_;
   llvm::Value* ptr_;
-  llvm::Function* get_char_;
-  llvm::Function* put_char_;
+  llvm::Value* tape_;
+  // Until the first unbalanced loop, ptr_ is tape_ + static_offset_
+  bool static_position_;
+  int static_offset_;
+  CodeGenABI abi_;
+  bool vectorize_;
+  bool saved_vectorize_;
+  bool promote_cells_;
+  bool promoting_;
+  // Stack slots for promoted cells, by offset from promoted_base_
+  std::map<int, llvm::Value*> promoted_;
+  std::set<int> promoted_writes_;
+  llvm::Value* promoted_base_;
+  int promoted_offset_;
+  CodeGenOptions options_;
+  // Each body is analyzed and keyed once, however many loops it sits in
+  BodyAccessCache access_cache_;
+  LoopKeyTable loop_keys_;
+  // Loop bodies by LoopKey::key
+  std::map<std::string, int> loop_counts_;
+  std::map<std::string, llvm::Function*> outlined_;
   llvm::Function* main_;
+  std::unique_ptr<llvm::DIBuilder> debug_builder_;
+  llvm::MDNode* debug_scope_;
   std::stack<llvm::IRBuilder<>> builders_;
 };
 
 llvm::Function* BuildProgramFromCanon(CNode* s, llvm::Module* module,
-                                      int store_size);
+                                      const CodeGenOptions& options);
 #endif  // CODEGEN_CANON
@@ -0,0 +1,295 @@
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <stack>
+#include <string>
+#include <vector>
+
+#include "canon_ir.h"
+#include "compact_ir.h"
+#include "lexer.h"
+
+size_t CompactProgram::Append(CompactOp op, int32_t a, int32_t b) {
+  ops_.push_back(op);
+  a_.push_back(a);
+  b_.push_back(b);
+  return ops_.size() - 1;
+}
+
+size_t CompactProgram::AppendWithExtra(CompactOp op, int32_t a,
+                                       std::initializer_list<int32_t> extra) {
+  size_t i = Append(op, a, extra_.size());
+  extra_.insert(extra_.end(), extra);
+  return i;
+}
+
+void CompactProgram::Clear() {
+  ops_.clear();
+  a_.clear();
+  b_.clear();
+  extra_.clear();
+}
+
+size_t CompactProgram::GetMemoryUsage() const {
+  return ops_.capacity() * sizeof(CompactOp) +
+         (a_.capacity() + b_.capacity() + extra_.capacity()) * sizeof(int32_t);
+}
+
+bool ParseCompact(std::istream& source, CompactProgram* program,
+                  std::string* error, size_t chunk_size) {
+  std::stack<size_t> loops;
+  // Merging stops at loop boundaries, so runs never cross into a body
+  bool can_merge = false;
+  Token tok;
+
+  while ((tok = GetNextToken(source))) {
+    size_t last = program->Size() - 1;
+    switch (tok) {
+      case INCR_PTR:
+      case DECR_PTR: {
+        int amt = tok == INCR_PTR ? 1 : -1;
+        if (can_merge && program->GetOp(last) == COP_PTR_MOV) {
+          program->SetA(last, program->GetA(last) + amt);
+        } else {
+          program->Append(COP_PTR_MOV, amt);
+        }
+        can_merge = true;
+        break;
+      }
+      case INCR_DATA:
+      case DECR_DATA: {
+        int amt = tok == INCR_DATA ? 1 : -1;
+        if (can_merge && program->GetOp(last) == COP_ADD) {
+          program->SetB(last, program->GetB(last) + amt);
+        } else {
+          program->Append(COP_ADD, 0, amt);
+        }
+        can_merge = true;
+        break;
+      }
+      case INPUT_DATA:
+        program->Append(COP_INPUT, 0);
+        can_merge = true;
+        break;
+      case OUTPUT_DATA:
+        program->Append(COP_OUTPUT, 0);
+        can_merge = true;
+        break;
+      case START_LOOP:
+        loops.push(program->Append(COP_LOOP));
+        can_merge = false;
+        break;
+      case END_LOOP:
+        if (loops.empty()) {
+          *error = "Unmatched end-loop";
+          return false;
+        }
+        program->SetA(loops.top(), program->Size());
+        loops.pop();
+        can_merge = false;
+        if (chunk_size && loops.empty()) {
+          return true;
+        }
+        break;
+      default:
+        *error = "Unknown token type (should never happen)";
+        return false;
+    }
+    if (chunk_size && loops.empty() && program->Size() >= chunk_size) {
+      return true;
+    }
+  }
+  if (!loops.empty()) {
+    *error = "Unmatched start-loop";
+    return false;
+  }
+  return true;
+}
+
+CompactEncoderVisitor::CompactEncoderVisitor(CompactProgram* program) {
+  program_ = program;
+}
+
+void CompactEncoderVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  }
+}
+
+void CompactEncoderVisitor::EncodeBody(size_t start, CNode* body) {
+  body->Accept(*this);
+  program_->SetA(start, program_->Size());
+}
+
+void CompactEncoderVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void CompactEncoderVisitor::Visit(CPtrMov* n) {
+  program_->Append(COP_PTR_MOV, n->GetAmt());
+  VisitNextCNode(n);
+}
+
+void CompactEncoderVisitor::Visit(CAdd* n) {
+  program_->Append(COP_ADD, n->GetOffset(), n->GetAmt());
+  VisitNextCNode(n);
+}
+
+void CompactEncoderVisitor::Visit(CMul* n) {
+  program_->AppendWithExtra(COP_MUL, n->GetOpOffset(),
+                            {n->GetTargetOffset(), n->GetAmt()});
+  VisitNextCNode(n);
+}
+
+void CompactEncoderVisitor::Visit(CSet* n) {
+  program_->Append(COP_SET, n->GetOffset(), n->GetAmt());
+  VisitNextCNode(n);
+}
+
+void CompactEncoderVisitor::Visit(CInput* n) {
+  program_->Append(COP_INPUT, n->GetOffset());
+  VisitNextCNode(n);
+}
+
+void CompactEncoderVisitor::Visit(COutput* n) {
+  program_->Append(COP_OUTPUT, n->GetOffset());
+  VisitNextCNode(n);
+}
+
+void CompactEncoderVisitor::Visit(CLoop* n) {
+  EncodeBody(program_->Append(COP_LOOP), n->GetBody());
+  VisitNextCNode(n);
+}
+
+void CompactEncoderVisitor::Visit(CIf* n) {
+  EncodeBody(program_->Append(COP_IF), n->GetBody());
+  VisitNextCNode(n);
+}
+
+void CompactEncoderVisitor::Visit(CCountedLoop* n) {
+  EncodeBody(program_->Append(COP_COUNTED_LOOP, 0, n->GetStep()),
+             n->GetBody());
+  VisitNextCNode(n);
+}
+
+void CompactEncoderVisitor::Visit(CDivMod* n) {
+  size_t start;
+  if (n->HasDivisorCell()) {
+    start = program_->AppendWithExtra(
+        COP_DIV_MOD_CELL, 0,
+        {n->GetDivisorOffset(), n->GetQuotientOffset(),
+         n->GetRemainderOffset(), n->GetTempOffset(),
+         n->GetSecondTempOffset()});
+  } else {
+    // A constant divisor has a single temporary
+    start = program_->AppendWithExtra(
+        COP_DIV_MOD, 0, {n->GetDivisor(), n->GetQuotientOffset(),
+                         n->GetRemainderOffset(), n->GetTempOffset()});
+  }
+  EncodeBody(start, n->GetBody());
+  VisitNextCNode(n);
+}
+
+void CompactEncoderVisitor::Visit(CSetRange* n) {
+  program_->AppendWithExtra(COP_SET_RANGE, n->GetOffset(),
+                            {n->GetCount(), n->GetAmt()});
+  VisitNextCNode(n);
+}
+
+void CompactEncoderVisitor::Visit(CMoveRange* n) {
+  program_->AppendWithExtra(COP_MOVE_RANGE, n->GetOffset(),
+                            {n->GetCount(), n->GetDistance()});
+  VisitNextCNode(n);
+}
+
+void EncodeCanonIR(CNode* n, CompactProgram* program) {
+  CompactEncoderVisitor visitor(program);
+  if (n) {
+    n->Accept(visitor);
+  }
+}
+
+CNode* DecodeCanonIR(const CompactProgram& program, size_t begin,
+                     size_t end) {
+  CNode* start_node = new CNode();
+  CNode* last = start_node;
+  size_t i = begin;
+  while (i < end) {
+    CNode* node = NULL;
+    size_t next = i + 1;
+    switch (program.GetOp(i)) {
+      case COP_PTR_MOV:
+        node = new CPtrMov(program.GetA(i));
+        break;
+      case COP_ADD:
+        node = new CAdd(program.GetA(i), program.GetB(i));
+        break;
+      case COP_MUL: {
+        const int32_t* extra = program.GetExtra(i);
+        node = new CMul(program.GetA(i), extra[0], extra[1]);
+        break;
+      }
+      case COP_SET:
+        node = new CSet(program.GetA(i), program.GetB(i));
+        break;
+      case COP_INPUT:
+        node = new CInput(program.GetA(i));
+        break;
+      case COP_OUTPUT:
+        node = new COutput(program.GetA(i));
+        break;
+      case COP_LOOP: {
+        CLoop* loop = new CLoop();
+        loop->SetBody(DecodeCanonIR(program, i + 1, program.GetA(i)));
+        node = loop;
+        next = program.GetA(i);
+        break;
+      }
+      case COP_IF: {
+        CIf* if_node = new CIf();
+        if_node->SetBody(DecodeCanonIR(program, i + 1, program.GetA(i)));
+        node = if_node;
+        next = program.GetA(i);
+        break;
+      }
+      case COP_COUNTED_LOOP: {
+        CCountedLoop* loop = new CCountedLoop(program.GetB(i));
+        loop->SetBody(DecodeCanonIR(program, i + 1, program.GetA(i)));
+        node = loop;
+        next = program.GetA(i);
+        break;
+      }
+      case COP_DIV_MOD: {
+        const int32_t* extra = program.GetExtra(i);
+        CDivMod* div_mod =
+            new CDivMod(extra[0], 0, extra[1], extra[2], extra[3], extra[3]);
+        div_mod->SetBody(DecodeCanonIR(program, i + 1, program.GetA(i)));
+        node = div_mod;
+        next = program.GetA(i);
+        break;
+      }
+      case COP_DIV_MOD_CELL: {
+        const int32_t* extra = program.GetExtra(i);
+        CDivMod* div_mod =
+            new CDivMod(0, extra[0], extra[1], extra[2], extra[3], extra[4]);
+        div_mod->SetBody(DecodeCanonIR(program, i + 1, program.GetA(i)));
+        node = div_mod;
+        next = program.GetA(i);
+        break;
+      }
+      case COP_SET_RANGE: {
+        const int32_t* extra = program.GetExtra(i);
+        node = new CSetRange(program.GetA(i), extra[0], extra[1]);
+        break;
+      }
+      case COP_MOVE_RANGE: {
+        const int32_t* extra = program.GetExtra(i);
+        node = new CMoveRange(program.GetA(i), extra[0], extra[1]);
+        break;
+      }
+    }
+    last->SetNextCNode(node);
+    last = node;
+    i = next;
+  }
+  return start_node;
+}
@@ -0,0 +1,102 @@
+#ifndef COMPACT_IR
+#define COMPACT_IR
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "canon_ir.h"
+
+// One byte per instruction, one kind per canonical IR node
+// Block instructions are followed by their body, and a holds the index
+// one past the end of it
+enum CompactOp : uint8_t {
+  COP_PTR_MOV,       // a = amt
+  COP_ADD,           // a = offset, b = amt
+  COP_MUL,           // a = op offset, extra = target offset, amt
+  COP_SET,           // a = offset, b = amt
+  COP_INPUT,         // a = offset
+  COP_OUTPUT,        // a = offset
+  COP_LOOP,          // a = end
+  COP_IF,            // a = end
+  COP_COUNTED_LOOP,  // a = end, b = step
+  COP_DIV_MOD,       // a = end, extra = divisor, quotient, remainder, temp
+  COP_SET_RANGE,     // a = offset, extra = count, amt
+  COP_MOVE_RANGE,    // a = offset, extra = count, distance
+  COP_DIV_MOD_CELL   // a = end, extra = divisor offset, quotient,
+                     //   remainder, temp, second temp
+};
+
+// Canonical IR stored as parallel arrays rather than linked nodes
+// An instruction costs 9 bytes, plus 4 per extra operand, against a
+// vtable, a unique_ptr and a heap block for each CNode
+class CompactProgram {
+ public:
+  size_t Size() const { return ops_.size(); }
+  CompactOp GetOp(size_t i) const { return ops_[i]; }
+  int32_t GetA(size_t i) const { return a_[i]; }
+  int32_t GetB(size_t i) const { return b_[i]; }
+  // For instructions with extra operands, b indexes the first of them
+  const int32_t* GetExtra(size_t i) const { return &extra_[b_[i]]; }
+  void SetA(size_t i, int32_t a) { a_[i] = a; }
+  void SetB(size_t i, int32_t b) { b_[i] = b; }
+
+  // Returns the index of the new instruction
+  size_t Append(CompactOp op, int32_t a = 0, int32_t b = 0);
+  size_t AppendWithExtra(CompactOp op, int32_t a,
+                         std::initializer_list<int32_t> extra);
+  void Clear();
+  // Bytes held by the arrays, including spare capacity
+  size_t GetMemoryUsage() const;
+
+ private:
+  std::vector<CompactOp> ops_;
+  std::vector<int32_t> a_;
+  std::vector<int32_t> b_;
+  std::vector<int32_t> extra_;
+};
+
+// Reads source straight into the compact form of the unoptimized
+// canonical IR, without building an AST
+// Runs of + - < > are merged into single instructions
+// If chunk_size is nonzero, stops at the end of the first top-level loop
+// or once chunk_size instructions are read, whichever comes first, so
+// that calling it again continues with the next chunk
+// Returns false and sets error if the loops are unbalanced
+bool ParseCompact(std::istream& source, CompactProgram* program,
+                  std::string* error, size_t chunk_size = 0);
+
+// Appends the nodes after n to program
+class CompactEncoderVisitor : public CNodeVisitor {
+ public:
+  CompactEncoderVisitor(CompactProgram* program);
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+ private:
+  void VisitNextCNode(CNode* n);
+  void EncodeBody(size_t start, CNode* body);
+  CompactProgram* program_;
+};
+
+void EncodeCanonIR(CNode* n, CompactProgram* program);
+
+// Builds nodes for the instructions in [begin, end)
+CNode* DecodeCanonIR(const CompactProgram& program, size_t begin,
+                     size_t end);
+
+#endif  // COMPACT_IR
@@ -0,0 +1,133 @@
+#include <stack>
+
+#include "canon_ir.h"
+#include "cell_access.h"
+#include "convert_counted_loops.h"
+
+static const int kCellModulus = 256;
+
+static int Wrap(int amt) {
+  return ((amt % kCellModulus) + kCellModulus) % kCellModulus;
+}
+
+CountedLoopVisitor::CountedLoopVisitor() {
+  start_node_ = new CNode();
+  blocks_.push(start_node_);
+}
+
+void CountedLoopVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  }
+}
+
+void CountedLoopVisitor::AddSimpleStatement(CNode* n) {
+  CNode* block = blocks_.top();
+  block->SetNextCNode(n);
+  blocks_.top() = n;
+}
+
+CNode* CountedLoopVisitor::VisitBody(CNode* body) {
+  CNode* body_node = new CNode();
+  blocks_.push(body_node);
+  body->Accept(*this);
+  blocks_.pop();
+  return body_node;
+}
+
+void CountedLoopVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void CountedLoopVisitor::Visit(CPtrMov* n) {
+  AddSimpleStatement(new CPtrMov(n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void CountedLoopVisitor::Visit(CAdd* n) {
+  AddSimpleStatement(new CAdd(n->GetOffset(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void CountedLoopVisitor::Visit(CMul* n) {
+  AddSimpleStatement(
+      new CMul(n->GetOpOffset(), n->GetTargetOffset(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void CountedLoopVisitor::Visit(CSet* n) {
+  AddSimpleStatement(new CSet(n->GetOffset(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void CountedLoopVisitor::Visit(CInput* n) {
+  AddSimpleStatement(new CInput(n->GetOffset()));
+  VisitNextCNode(n);
+}
+
+void CountedLoopVisitor::Visit(COutput* n) {
+  AddSimpleStatement(new COutput(n->GetOffset()));
+  VisitNextCNode(n);
+}
+
+void CountedLoopVisitor::Visit(CLoop* n) {
+  CNode* body_node = VisitBody(n->GetBody());
+
+  // The loop cell must only change by the same step on every pass
+  const BodyAccess& access = GetBodyAccess(body_node, &access_cache_);
+  auto step = access.adds.find(0);
+  if (access.IsTracked() && !access.other_writes.count(0) &&
+      step != access.adds.end() && Wrap(step->second) != 0) {
+    CCountedLoop* loop = new CCountedLoop(Wrap(step->second));
+    loop->SetBody(body_node);
+    AddSimpleStatement(loop);
+  } else {
+    CLoop* loop = new CLoop();
+    loop->SetBody(body_node);
+    AddSimpleStatement(loop);
+  }
+  VisitNextCNode(n);
+}
+
+void CountedLoopVisitor::Visit(CIf* n) {
+  CIf* if_node = new CIf();
+  if_node->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(if_node);
+  VisitNextCNode(n);
+}
+
+void CountedLoopVisitor::Visit(CCountedLoop* n) {
+  CCountedLoop* loop = new CCountedLoop(n->GetStep());
+  loop->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(loop);
+  VisitNextCNode(n);
+}
+
+void CountedLoopVisitor::Visit(CDivMod* n) {
+  CDivMod* div_mod =
+      new CDivMod(n->GetDivisor(), n->GetDivisorOffset(),
+                  n->GetQuotientOffset(), n->GetRemainderOffset(),
+                  n->GetTempOffset(), n->GetSecondTempOffset());
+  div_mod->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(div_mod);
+  VisitNextCNode(n);
+}
+
+void CountedLoopVisitor::Visit(CSetRange* n) {
+  AddSimpleStatement(
+      new CSetRange(n->GetOffset(), n->GetCount(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void CountedLoopVisitor::Visit(CMoveRange* n) {
+  AddSimpleStatement(
+      new CMoveRange(n->GetOffset(), n->GetCount(), n->GetDistance()));
+  VisitNextCNode(n);
+}
+
+CNode* ConvertCountedLoops(CNode* n) {
+  CountedLoopVisitor visitor;
+  if (n) {
+    n->Accept(visitor);
+  }
+  return visitor.GetProgram();
+}
@@ -0,0 +1,42 @@
+#ifndef CONVERT_COUNTED_LOOPS
+#define CONVERT_COUNTED_LOOPS
+
+#include <stack>
+
+#include "canon_ir.h"
+#include "cell_access.h"
+
+// Rewrites balanced loops that step the loop cell by a constant into
+// CCountedLoop nodes, whatever else the body does
+class CountedLoopVisitor : public CNodeVisitor {
+ public:
+  CountedLoopVisitor();
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  CNode* GetProgram() { return start_node_; }
+
+ private:
+  void VisitNextCNode(CNode* n);
+  void AddSimpleStatement(CNode* n);
+  CNode* VisitBody(CNode* body);
+  std::stack<CNode*> blocks_;
+  CNode* start_node_;
+  // Bodies nested in a loop are summarized once, when their own loop is
+  BodyAccessCache access_cache_;
+};
+
+CNode* ConvertCountedLoops(CNode* n);
+
+#endif  // CONVERT_COUNTED_LOOPS
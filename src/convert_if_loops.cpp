@@ -0,0 +1,257 @@
+#include <map>
+#include <set>
+#include <stack>
+#include <vector>
+
+#include "canon_ir.h"
+#include "convert_if_loops.h"
+
+static const int kCellModulus = 256;
+
+ZeroedCellsVisitor::ZeroedCellsVisitor(BalancedBodies* balanced) {
+  balanced_ = balanced;
+  known_ = true;
+  ptr_mov_ = 0;
+}
+
+bool ZeroedCellsVisitor::RunsAtMostOnce() {
+  return IsBalanced() && zeroed_.count(0);
+}
+
+void ZeroedCellsVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  }
+}
+
+void ZeroedCellsVisitor::VisitNested(CNode* body) {
+  auto it = balanced_->find(body);
+  if (it == balanced_->end()) {
+    ZeroedCellsVisitor nested(balanced_);
+    body->Accept(nested);
+    it = balanced_->insert(std::make_pair(body, nested.IsBalanced())).first;
+  }
+  if (!it->second) {
+    known_ = false;
+  }
+
+  // The body may write anywhere, but it only exits on a zero cell
+  zeroed_.clear();
+  zeroed_.insert(ptr_mov_);
+}
+
+void ZeroedCellsVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void ZeroedCellsVisitor::Visit(CPtrMov* n) {
+  ptr_mov_ += n->GetAmt();
+  VisitNextCNode(n);
+}
+
+void ZeroedCellsVisitor::Visit(CAdd* n) {
+  if (n->GetAmt() % kCellModulus != 0) {
+    zeroed_.erase(ptr_mov_ + n->GetOffset());
+  }
+  VisitNextCNode(n);
+}
+
+void ZeroedCellsVisitor::Visit(CMul* n) {
+  zeroed_.erase(ptr_mov_ + n->GetTargetOffset());
+  VisitNextCNode(n);
+}
+
+void ZeroedCellsVisitor::Visit(CSet* n) {
+  if (n->GetAmt() % kCellModulus == 0) {
+    zeroed_.insert(ptr_mov_ + n->GetOffset());
+  } else {
+    zeroed_.erase(ptr_mov_ + n->GetOffset());
+  }
+  VisitNextCNode(n);
+}
+
+void ZeroedCellsVisitor::Visit(CInput* n) {
+  zeroed_.erase(ptr_mov_ + n->GetOffset());
+  VisitNextCNode(n);
+}
+
+void ZeroedCellsVisitor::Visit(COutput* n) { VisitNextCNode(n); }
+
+void ZeroedCellsVisitor::Visit(CLoop* n) {
+  VisitNested(n->GetBody());
+  VisitNextCNode(n);
+}
+
+void ZeroedCellsVisitor::Visit(CIf* n) {
+  VisitNested(n->GetBody());
+  VisitNextCNode(n);
+}
+
+void ZeroedCellsVisitor::Visit(CCountedLoop* n) {
+  VisitNested(n->GetBody());
+  VisitNextCNode(n);
+}
+
+void ZeroedCellsVisitor::Visit(CDivMod* n) {
+  VisitNested(n->GetBody());
+  VisitNextCNode(n);
+}
+
+void ZeroedCellsVisitor::Visit(CSetRange* n) {
+  for (int i = 0; i < n->GetCount(); i++) {
+    if (n->GetAmt() % kCellModulus == 0) {
+      zeroed_.insert(ptr_mov_ + n->GetOffset() + i);
+    } else {
+      zeroed_.erase(ptr_mov_ + n->GetOffset() + i);
+    }
+  }
+  VisitNextCNode(n);
+}
+
+void ZeroedCellsVisitor::Visit(CMoveRange* n) {
+  // Each target cell is zero if its source was, and sources end up zero
+  // unless overwritten
+  int source = ptr_mov_ + n->GetOffset();
+  int target = source + n->GetDistance();
+  std::vector<bool> moved_zero;
+  for (int i = 0; i < n->GetCount(); i++) {
+    moved_zero.push_back(zeroed_.count(source + i) > 0);
+    zeroed_.insert(source + i);
+  }
+  for (int i = 0; i < n->GetCount(); i++) {
+    if (moved_zero[i]) {
+      zeroed_.insert(target + i);
+    } else {
+      zeroed_.erase(target + i);
+    }
+  }
+  VisitNextCNode(n);
+}
+
+IfLoopVisitor::IfLoopVisitor() {
+  start_node_ = new CNode();
+  blocks_.push(start_node_);
+}
+
+void IfLoopVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  }
+}
+
+void IfLoopVisitor::AddSimpleStatement(CNode* n) {
+  CNode* block = blocks_.top();
+  block->SetNextCNode(n);
+  blocks_.top() = n;
+}
+
+CNode* IfLoopVisitor::VisitBody(CNode* body, ZeroedCellsVisitor* zeroed) {
+  CNode* body_node = new CNode();
+  blocks_.push(body_node);
+  body->Accept(*this);
+  blocks_.pop();
+
+  // Nested bodies were summarized as they were rebuilt, so this only
+  // walks the statements of this one
+  body_node->Accept(*zeroed);
+  balanced_[body_node] = zeroed->IsBalanced();
+  return body_node;
+}
+
+CNode* IfLoopVisitor::VisitBody(CNode* body) {
+  ZeroedCellsVisitor zeroed(&balanced_);
+  return VisitBody(body, &zeroed);
+}
+
+void IfLoopVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void IfLoopVisitor::Visit(CPtrMov* n) {
+  AddSimpleStatement(new CPtrMov(n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void IfLoopVisitor::Visit(CAdd* n) {
+  AddSimpleStatement(new CAdd(n->GetOffset(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void IfLoopVisitor::Visit(CMul* n) {
+  AddSimpleStatement(
+      new CMul(n->GetOpOffset(), n->GetTargetOffset(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void IfLoopVisitor::Visit(CSet* n) {
+  AddSimpleStatement(new CSet(n->GetOffset(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void IfLoopVisitor::Visit(CInput* n) {
+  AddSimpleStatement(new CInput(n->GetOffset()));
+  VisitNextCNode(n);
+}
+
+void IfLoopVisitor::Visit(COutput* n) {
+  AddSimpleStatement(new COutput(n->GetOffset()));
+  VisitNextCNode(n);
+}
+
+void IfLoopVisitor::Visit(CLoop* n) {
+  // Inner loops are converted first so they count as zeroing their cell
+  ZeroedCellsVisitor zeroed(&balanced_);
+  CNode* body_node = VisitBody(n->GetBody(), &zeroed);
+  if (zeroed.RunsAtMostOnce()) {
+    CIf* if_node = new CIf();
+    if_node->SetBody(body_node);
+    AddSimpleStatement(if_node);
+  } else {
+    CLoop* loop = new CLoop();
+    loop->SetBody(body_node);
+    AddSimpleStatement(loop);
+  }
+  VisitNextCNode(n);
+}
+
+void IfLoopVisitor::Visit(CIf* n) {
+  CIf* if_node = new CIf();
+  if_node->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(if_node);
+  VisitNextCNode(n);
+}
+
+void IfLoopVisitor::Visit(CCountedLoop* n) {
+  CCountedLoop* loop = new CCountedLoop(n->GetStep());
+  loop->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(loop);
+  VisitNextCNode(n);
+}
+
+void IfLoopVisitor::Visit(CDivMod* n) {
+  CDivMod* div_mod =
+      new CDivMod(n->GetDivisor(), n->GetDivisorOffset(),
+                  n->GetQuotientOffset(), n->GetRemainderOffset(),
+                  n->GetTempOffset(), n->GetSecondTempOffset());
+  div_mod->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(div_mod);
+  VisitNextCNode(n);
+}
+
+void IfLoopVisitor::Visit(CSetRange* n) {
+  AddSimpleStatement(
+      new CSetRange(n->GetOffset(), n->GetCount(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void IfLoopVisitor::Visit(CMoveRange* n) {
+  AddSimpleStatement(
+      new CMoveRange(n->GetOffset(), n->GetCount(), n->GetDistance()));
+  VisitNextCNode(n);
+}
+
+CNode* ConvertIfLoops(CNode* n) {
+  IfLoopVisitor visitor;
+  if (n) {
+    n->Accept(visitor);
+  }
+  return visitor.GetProgram();
+}
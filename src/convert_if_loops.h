@@ -0,0 +1,81 @@
+#ifndef CONVERT_IF_LOOPS
+#define CONVERT_IF_LOOPS
+
+#include <map>
+#include <set>
+#include <stack>
+
+#include "canon_ir.h"
+
+// Whether each body already summarized is balanced, by body
+typedef std::map<CNode*, bool> BalancedBodies;
+
+// Tracks which cells are known to be zero at the end of a body, and
+// whether its net pointer movement is known
+// Nested bodies are looked up in balanced, and summarized into it first
+// if missing, so each body is only walked once however deep it is
+class ZeroedCellsVisitor : public CNodeVisitor {
+ public:
+  explicit ZeroedCellsVisitor(BalancedBodies* balanced);
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  bool IsBalanced() { return known_ && ptr_mov_ == 0; }
+  // True if the body ends where it started and leaves that cell zero
+  bool RunsAtMostOnce();
+
+ private:
+  void VisitNextCNode(CNode* n);
+  void VisitNested(CNode* body);
+  BalancedBodies* balanced_;
+  std::set<int> zeroed_;
+  bool known_;
+  int ptr_mov_;
+};
+
+// Rewrites loops that run at most once into CIf nodes
+class IfLoopVisitor : public CNodeVisitor {
+ public:
+  IfLoopVisitor();
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  CNode* GetProgram() { return start_node_; }
+
+ private:
+  void VisitNextCNode(CNode* n);
+  void AddSimpleStatement(CNode* n);
+  // Rebuilds body and summarizes the result into zeroed
+  CNode* VisitBody(CNode* body, ZeroedCellsVisitor* zeroed);
+  CNode* VisitBody(CNode* body);
+  std::stack<CNode*> blocks_;
+  CNode* start_node_;
+  // Filled in bottom-up as bodies are rebuilt
+  BalancedBodies balanced_;
+};
+
+CNode* ConvertIfLoops(CNode* n);
+
+#endif  // CONVERT_IF_LOOPS
@@ -0,0 +1,190 @@
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "parser.h"
+#include "canon_ir.h"
+#include "canon_translate.h"
+#include "differential.h"
+#include "interpret_canon.h"
+#include "libbf.h"
+#include "optimize.h"
+#include "random_program.h"
+#include "runtime.h"
+
+// Step budget for each generated program
+static const uint64_t kFuzzSteps = 100000;
+// Bytes of random input given to each generated program
+static const int kFuzzInputLen = 16;
+
+// Everything a run leaves behind
+struct RunRecord {
+  BFStatus status = BF_OK;
+  std::string output;
+  std::vector<char> tape;
+};
+
+static void AppendOutput(void* user, const char* data, size_t len) {
+  static_cast<std::string*>(user)->append(data, len);
+}
+
+static RunRecord Interpret(CNode* prog, const std::string& input,
+                           unsigned store_size, uint64_t max_steps) {
+  RunRecord record;
+  record.tape.resize(store_size);
+  char output[4096];
+  BFContext ctx;
+  InitContext(&ctx, record.tape.data(), record.tape.size(), input.data(),
+              input.size(), output, sizeof(output), AppendOutput,
+              &record.output);
+  SetBudget(&ctx, max_steps, 0);
+  record.status = InterpretCanonIR(prog, &ctx);
+  FlushContext(&ctx);
+  return record;
+}
+
+static bool RunCompiled(const std::string& source, const BFOptions& options,
+                        const std::string& input, uint64_t max_steps,
+                        RunRecord* record, std::string* error) {
+  std::unique_ptr<BFProgram> program(BFCompile(source, options, error));
+  if (!program) {
+    return false;
+  }
+  record->tape.resize(program->GetStoreSize());
+  char output[4096];
+  BFContext ctx;
+  InitContext(&ctx, record->tape.data(), record->tape.size(), input.data(),
+              input.size(), output, sizeof(output), AppendOutput,
+              &record->output);
+  SetBudget(&ctx, max_steps, 0);
+  record->status = BFRunContext(program.get(), &ctx);
+  FlushContext(&ctx);
+  return true;
+}
+
+// Describes the first way other differs from the reference
+static bool Compare(const std::string& name, const RunRecord& reference,
+                    const RunRecord& other, std::string* report) {
+  std::stringstream ss;
+  if (other.status != reference.status) {
+    ss << name << ": status " << other.status << ", expected "
+       << reference.status;
+  } else if (other.output != reference.output) {
+    size_t i = 0;
+    while (i < other.output.size() && i < reference.output.size() &&
+           other.output[i] == reference.output[i]) {
+      i++;
+    }
+    ss << name << ": output differs at byte " << i << " ("
+       << other.output.size() << " bytes, expected "
+       << reference.output.size() << ")";
+  } else {
+    for (size_t i = 0; i < reference.tape.size(); i++) {
+      if (other.tape[i] != reference.tape[i]) {
+        ss << name << ": cell " << i << " is "
+           << (int)(unsigned char)other.tape[i] << ", expected "
+           << (int)(unsigned char)reference.tape[i];
+        break;
+      }
+    }
+  }
+  *report = ss.str();
+  return report->empty();
+}
+
+DiffStatus CheckEquivalence(const std::string& source,
+                            const std::string& input, unsigned store_size,
+                            uint64_t max_steps, std::string* report) {
+  if (!BFCheckLoops(source, report)) {
+    return DIFF_SKIPPED;
+  }
+
+  std::istringstream source_stream(source);
+  std::unique_ptr<ASTNode> ast(Parse(source_stream));
+  std::unique_ptr<CNode> plain(TranslateASTToCanonIR(ast.get()));
+  RunRecord reference = Interpret(plain.get(), input, store_size, max_steps);
+  if (reference.status == BF_OUT_OF_TAPE) {
+    *report = "reference run left the tape";
+    return DIFF_SKIPPED;
+  } else if (reference.status == BF_OUT_OF_STEPS) {
+    *report = "reference run ran out of steps";
+    return DIFF_SKIPPED;
+  }
+
+  // Optimizations only remove back-edges, so the same budget suffices
+  std::unique_ptr<CNode> optimized(OptimizeCanonIR(plain.get()));
+  RunRecord optimized_run =
+      Interpret(optimized.get(), input, store_size, max_steps);
+  if (!Compare("optimized interpreter", reference, optimized_run, report)) {
+    return DIFF_MISMATCH;
+  }
+
+  // Compiled code is only run once the reference shows it stays on the
+  // tape
+  BFOptions ast_options;
+  ast_options.store_size = store_size;
+  ast_options.count_steps = true;
+  RunRecord ast_run;
+  if (!RunCompiled(source, ast_options, input, max_steps, &ast_run, report) ||
+      !Compare("AST codegen", reference, ast_run, report)) {
+    return DIFF_MISMATCH;
+  }
+
+  // Run without counting steps so codegen takes every fast path; the
+  // reference finished, so correct code does too
+  BFOptions canon_options;
+  canon_options.optimize_bf = true;
+  canon_options.optimize_llvm = true;
+  canon_options.store_size = store_size;
+  RunRecord canon_run;
+  if (!RunCompiled(source, canon_options, input, 0, &canon_run, report)) {
+    return DIFF_MISMATCH;
+  }
+  if (!Compare("optimized codegen", reference, canon_run, report)) {
+    return DIFF_MISMATCH;
+  }
+  return DIFF_SAME;
+}
+
+int FuzzOptimizer(unsigned count, unsigned seed, unsigned store_size,
+                  std::ostream& log) {
+  std::mt19937 rng(seed);
+  GeneratorOptions options;
+  int same = 0;
+  int skipped = 0;
+  int mismatches = 0;
+
+  for (unsigned i = 0; i < count; i++) {
+    std::string program = GenerateProgram(rng, options);
+    std::string input;
+    for (int j = 0; j < kFuzzInputLen; j++) {
+      input += (char)std::uniform_int_distribution<int>(0, 255)(rng);
+    }
+
+    std::string report;
+    switch (CheckEquivalence(program, input, store_size, kFuzzSteps,
+                             &report)) {
+      case DIFF_SAME:
+        same++;
+        break;
+      case DIFF_SKIPPED:
+        skipped++;
+        break;
+      case DIFF_MISMATCH:
+        mismatches++;
+        log << "Mismatch in program " << i << " of seed " << seed << ": "
+            << report << std::endl
+            << program << std::endl;
+        break;
+    }
+  }
+
+  log << count << " programs from seed " << seed << ": " << same
+      << " equivalent, " << skipped << " skipped, " << mismatches
+      << " mismatched" << std::endl;
+  return mismatches;
+}
@@ -0,0 +1,34 @@
+#ifndef DIFFERENTIAL
+#define DIFFERENTIAL
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+enum DiffStatus {
+  DIFF_SAME,
+  DIFF_MISMATCH,
+  // The reference run did not finish cleanly, so there is nothing to
+  // compare against
+  DIFF_SKIPPED
+};
+
+// Runs source on input through the interpreter on plain canonical IR,
+// which is the reference, and then through
+//   the interpreter on optimized canonical IR,
+//   the unoptimized AST code generator,
+//   the optimized canonical code generator with LLVM optimizations,
+// comparing status, output and the final tape
+// A zero max_steps runs the reference without a step budget
+// Sets report to the first difference found, or the reason for skipping
+DiffStatus CheckEquivalence(const std::string& source,
+                            const std::string& input, unsigned store_size,
+                            uint64_t max_steps, std::string* report);
+
+// Checks count random programs generated from seed, logging each
+// mismatch with its program and a summary at the end
+// Returns the number of mismatches
+int FuzzOptimizer(unsigned count, unsigned seed, unsigned store_size,
+                  std::ostream& log);
+
+#endif  // DIFFERENTIAL
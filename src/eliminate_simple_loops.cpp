@@ -109,6 +109,65 @@ void SimpleLoopElimVisitor::Visit(CLoop* n) {
   VisitNextCNode(n);
 }
 
+void SimpleLoopElimVisitor::Visit(CIf* n) {
+  CNode* body_node = new CNode();
+
+  blocks_.push(body_node);
+  n->GetBody()->Accept(*this);
+  blocks_.pop();
+
+  CIf* if_node = new CIf();
+  if_node->SetBody(body_node);
+  AddSimpleStatement(if_node);
+  is_simple_ = false;
+  VisitNextCNode(n);
+}
+
+void SimpleLoopElimVisitor::Visit(CCountedLoop* n) {
+  CNode* body_node = new CNode();
+
+  blocks_.push(body_node);
+  n->GetBody()->Accept(*this);
+  blocks_.pop();
+
+  CCountedLoop* loop = new CCountedLoop(n->GetStep());
+  loop->SetBody(body_node);
+  AddSimpleStatement(loop);
+  is_simple_ = false;
+  VisitNextCNode(n);
+}
+
+void SimpleLoopElimVisitor::Visit(CDivMod* n) {
+  CNode* body_node = new CNode();
+
+  blocks_.push(body_node);
+  n->GetBody()->Accept(*this);
+  blocks_.pop();
+
+  CDivMod* div_mod =
+      new CDivMod(n->GetDivisor(), n->GetDivisorOffset(),
+                  n->GetQuotientOffset(), n->GetRemainderOffset(),
+                  n->GetTempOffset(), n->GetSecondTempOffset());
+  div_mod->SetBody(body_node);
+  AddSimpleStatement(div_mod);
+  is_simple_ = false;
+  VisitNextCNode(n);
+}
+
+void SimpleLoopElimVisitor::Visit(CSetRange* n) {
+  is_simple_ = false;
+  AddSimpleStatement(
+      new CSetRange(n->GetOffset(), n->GetCount(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void SimpleLoopElimVisitor::Visit(CMoveRange* n) {
+  is_simple_ = false;
+  AddSimpleStatement(
+      new CMoveRange(n->GetOffset(), n->GetCount(), n->GetDistance()));
+  VisitNextCNode(n);
+}
+
 CNode* EliminateSimpleLoops(CNode* n) {
   SimpleLoopElimVisitor visitor;
   if (n) {
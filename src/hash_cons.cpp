@@ -0,0 +1,186 @@
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <string>
+
+#include "canon_ir.h"
+#include "compact_ir.h"
+#include "hash_cons.h"
+
+const LoopKey& LoopKeyTable::GetKey(CNode* body) {
+  auto it = keys_.find(body);
+  if (it == keys_.end()) {
+    LoopKeyVisitor visitor(this);
+    body->Accept(visitor);
+    it = keys_.insert(std::make_pair(body, visitor.GetKey())).first;
+  }
+  return it->second;
+}
+
+int32_t LoopKeyTable::GetId(CNode* body) {
+  const std::string& key = GetKey(body).key;
+  auto it = ids_.find(key);
+  if (it == ids_.end()) {
+    int32_t id = ids_.size();
+    it = ids_.insert(std::make_pair(key, id)).first;
+  }
+  return it->second;
+}
+
+LoopKeyVisitor::LoopKeyVisitor(LoopKeyTable* table) {
+  table_ = table;
+  key_.size = 0;
+  key_.has_io = false;
+}
+
+void LoopKeyVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  }
+}
+
+void LoopKeyVisitor::Append(CompactOp op,
+                            std::initializer_list<int32_t> operands) {
+  key_.key += static_cast<char>(op);
+  for (int32_t operand : operands) {
+    key_.key.append(reinterpret_cast<const char*>(&operand),
+                    sizeof(operand));
+  }
+  key_.size++;
+}
+
+void LoopKeyVisitor::AppendNested(CompactOp op,
+                                  std::initializer_list<int32_t> operands,
+                                  CNode* body) {
+  Append(op, operands);
+  int32_t id = table_->GetId(body);
+  key_.key.append(reinterpret_cast<const char*>(&id), sizeof(id));
+  const LoopKey& nested = table_->GetKey(body);
+  key_.size += nested.size;
+  key_.has_io = key_.has_io || nested.has_io;
+}
+
+void LoopKeyVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void LoopKeyVisitor::Visit(CPtrMov* n) {
+  Append(COP_PTR_MOV, {n->GetAmt()});
+  VisitNextCNode(n);
+}
+
+void LoopKeyVisitor::Visit(CAdd* n) {
+  Append(COP_ADD, {n->GetOffset(), n->GetAmt()});
+  VisitNextCNode(n);
+}
+
+void LoopKeyVisitor::Visit(CMul* n) {
+  Append(COP_MUL, {n->GetOpOffset(), n->GetTargetOffset(), n->GetAmt()});
+  VisitNextCNode(n);
+}
+
+void LoopKeyVisitor::Visit(CSet* n) {
+  Append(COP_SET, {n->GetOffset(), n->GetAmt()});
+  VisitNextCNode(n);
+}
+
+void LoopKeyVisitor::Visit(CInput* n) {
+  Append(COP_INPUT, {n->GetOffset()});
+  key_.has_io = true;
+  VisitNextCNode(n);
+}
+
+void LoopKeyVisitor::Visit(COutput* n) {
+  Append(COP_OUTPUT, {n->GetOffset()});
+  key_.has_io = true;
+  VisitNextCNode(n);
+}
+
+void LoopKeyVisitor::Visit(CLoop* n) {
+  AppendNested(COP_LOOP, {}, n->GetBody());
+  VisitNextCNode(n);
+}
+
+void LoopKeyVisitor::Visit(CIf* n) {
+  AppendNested(COP_IF, {}, n->GetBody());
+  VisitNextCNode(n);
+}
+
+void LoopKeyVisitor::Visit(CCountedLoop* n) {
+  AppendNested(COP_COUNTED_LOOP, {n->GetStep()}, n->GetBody());
+  VisitNextCNode(n);
+}
+
+void LoopKeyVisitor::Visit(CDivMod* n) {
+  if (n->HasDivisorCell()) {
+    AppendNested(COP_DIV_MOD_CELL,
+                 {n->GetDivisorOffset(), n->GetQuotientOffset(),
+                  n->GetRemainderOffset(), n->GetTempOffset(),
+                  n->GetSecondTempOffset()},
+                 n->GetBody());
+  } else {
+    AppendNested(COP_DIV_MOD,
+                 {n->GetDivisor(), n->GetQuotientOffset(),
+                  n->GetRemainderOffset(), n->GetTempOffset()},
+                 n->GetBody());
+  }
+  VisitNextCNode(n);
+}
+
+void LoopKeyVisitor::Visit(CSetRange* n) {
+  Append(COP_SET_RANGE, {n->GetOffset(), n->GetCount(), n->GetAmt()});
+  VisitNextCNode(n);
+}
+
+void LoopKeyVisitor::Visit(CMoveRange* n) {
+  Append(COP_MOVE_RANGE,
+         {n->GetOffset(), n->GetCount(), n->GetDistance()});
+  VisitNextCNode(n);
+}
+
+LoopCountVisitor::LoopCountVisitor(LoopKeyTable* table) { table_ = table; }
+
+void LoopCountVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  }
+}
+
+void LoopCountVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void LoopCountVisitor::Visit(CPtrMov* n) { VisitNextCNode(n); }
+
+void LoopCountVisitor::Visit(CAdd* n) { VisitNextCNode(n); }
+
+void LoopCountVisitor::Visit(CMul* n) { VisitNextCNode(n); }
+
+void LoopCountVisitor::Visit(CSet* n) { VisitNextCNode(n); }
+
+void LoopCountVisitor::Visit(CInput* n) { VisitNextCNode(n); }
+
+void LoopCountVisitor::Visit(COutput* n) { VisitNextCNode(n); }
+
+void LoopCountVisitor::Visit(CLoop* n) {
+  counts_[table_->GetKey(n->GetBody()).key]++;
+  n->GetBody()->Accept(*this);
+  VisitNextCNode(n);
+}
+
+void LoopCountVisitor::Visit(CIf* n) {
+  n->GetBody()->Accept(*this);
+  VisitNextCNode(n);
+}
+
+void LoopCountVisitor::Visit(CCountedLoop* n) {
+  n->GetBody()->Accept(*this);
+  VisitNextCNode(n);
+}
+
+void LoopCountVisitor::Visit(CDivMod* n) {
+  n->GetBody()->Accept(*this);
+  VisitNextCNode(n);
+}
+
+void LoopCountVisitor::Visit(CSetRange* n) { VisitNextCNode(n); }
+
+void LoopCountVisitor::Visit(CMoveRange* n) { VisitNextCNode(n); }
@@ -0,0 +1,96 @@
+#ifndef HASH_CONS
+#define HASH_CONS
+
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <string>
+
+#include "canon_ir.h"
+#include "compact_ir.h"
+
+// Structural identity of a loop body
+struct LoopKey {
+  // Equal exactly for identical bodies
+  std::string key;
+  // Instructions in the body, nested bodies included
+  size_t size;
+  bool has_io;
+};
+
+// Keys for loop bodies, each computed once per body
+// A key spells out the body's own instructions and names each nested
+// body by a number standing for that body's key, so keys stay short
+// however deep the nesting, and equal bodies get equal numbers
+class LoopKeyTable {
+ public:
+  const LoopKey& GetKey(CNode* body);
+  // The number standing for body's key
+  int32_t GetId(CNode* body);
+  // Drops the keys remembered by node, for when the nodes may be freed
+  // Keys computed afterwards still match equal ones computed before
+  void ForgetNodes() { keys_.clear(); }
+
+ private:
+  std::map<CNode*, LoopKey> keys_;
+  std::map<std::string, int32_t> ids_;
+};
+
+// Builds the key of the body it visits, taking nested bodies' from table
+class LoopKeyVisitor : public CNodeVisitor {
+ public:
+  explicit LoopKeyVisitor(LoopKeyTable* table);
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  const LoopKey& GetKey() { return key_; }
+
+ private:
+  void VisitNextCNode(CNode* n);
+  void Append(CompactOp op, std::initializer_list<int32_t> operands);
+  // Appends a block instruction, with body's number as its last operand
+  void AppendNested(CompactOp op, std::initializer_list<int32_t> operands,
+                    CNode* body);
+  LoopKeyTable* table_;
+  LoopKey key_;
+};
+
+// Counts how often each CLoop body occurs, nested loops included
+class LoopCountVisitor : public CNodeVisitor {
+ public:
+  explicit LoopCountVisitor(LoopKeyTable* table);
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  // By LoopKey::key
+  std::map<std::string, int>& GetCounts() { return counts_; }
+
+ private:
+  void VisitNextCNode(CNode* n);
+  LoopKeyTable* table_;
+  std::map<std::string, int> counts_;
+};
+
+#endif  // HASH_CONS
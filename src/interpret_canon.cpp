@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "canon_ir.h"
+#include "cell_access.h"
+#include "interpret_canon.h"
+#include "runtime.h"
+
+CanonInterpreterVisitor::CanonInterpreterVisitor(BFContext* ctx) {
+  ctx_ = ctx;
+  ptr_ = 0;
+  status_ = BF_OK;
+  profile_ = nullptr;
+  tape_ = nullptr;
+}
+
+void CanonInterpreterVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next && status_ == BF_OK) {
+    next->Accept(*this);
+  }
+}
+
+char* CanonInterpreterVisitor::GetCell(int offset, int access) {
+  int64_t cell = ptr_ + offset;
+  if (cell < 0 || (uint64_t)cell >= ctx_->tape_size) {
+    status_ = BF_OUT_OF_TAPE;
+    return nullptr;
+  }
+  if (tape_) {
+    RecordCellAccess(tape_, cell, access);
+  }
+  return &ctx_->tape[cell];
+}
+
+bool CanonInterpreterVisitor::ChargeBackEdge() {
+  // Same split between fast and slow path as codegen_abi.cpp
+  if (ctx_->steps > 1) {
+    ctx_->steps--;
+  } else if (!bf_ctx_refill(ctx_, 1)) {
+    status_ = BF_OUT_OF_STEPS;
+    return false;
+  }
+  return true;
+}
+
+uint64_t CanonInterpreterVisitor::RunLoop(CNode* body) {
+  // Charged on exit like codegen_canon.cpp does
+  bool moving = GetBodyAccess(body, &access_cache_).IsMoving();
+  uint64_t trips = 0;
+  char* cell = GetCell(0, CELL_READ);
+  while (cell && *cell) {
+    body->Accept(*this);
+    trips++;
+    if (status_ != BF_OK || (!moving && !ChargeBackEdge())) {
+      break;
+    }
+    cell = GetCell(0, CELL_READ);
+  }
+  if (moving) {
+    ctx_->steps -= trips;
+  }
+  return trips;
+}
+
+void CanonInterpreterVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void CanonInterpreterVisitor::Visit(CPtrMov* n) {
+  ptr_ += n->GetAmt();
+  if (tape_) {
+    tape_->min_ptr = std::min(tape_->min_ptr, ptr_);
+    tape_->max_ptr = std::max(tape_->max_ptr, ptr_);
+  }
+  VisitNextCNode(n);
+}
+
+void CanonInterpreterVisitor::Visit(CAdd* n) {
+  char* cell = GetCell(n->GetOffset(), CELL_READ | CELL_WRITE);
+  if (cell) {
+    *cell += n->GetAmt();
+  }
+  VisitNextCNode(n);
+}
+
+void CanonInterpreterVisitor::Visit(CMul* n) {
+  // A zero operand stands for a loop that never ran, so the target is
+  // not touched
+  char* op = GetCell(n->GetOpOffset(), CELL_READ);
+  if (op && *op) {
+    char* target = GetCell(n->GetTargetOffset(), CELL_READ | CELL_WRITE);
+    if (target) {
+      *target += (unsigned char)*op * n->GetAmt();
+    }
+  }
+  VisitNextCNode(n);
+}
+
+void CanonInterpreterVisitor::Visit(CSet* n) {
+  char* cell = GetCell(n->GetOffset(), CELL_WRITE);
+  if (cell) {
+    *cell = n->GetAmt();
+  }
+  VisitNextCNode(n);
+}
+
+void CanonInterpreterVisitor::Visit(CInput* n) {
+  char* cell = GetCell(n->GetOffset(), CELL_WRITE);
+  if (cell) {
+    if (ctx_->input_pos < ctx_->input_len) {
+      *cell = ctx_->input[ctx_->input_pos++];
+    } else {
+      *cell = bf_ctx_read(ctx_);
+    }
+  }
+  VisitNextCNode(n);
+}
+
+void CanonInterpreterVisitor::Visit(COutput* n) {
+  char* cell = GetCell(n->GetOffset(), CELL_READ);
+  if (cell) {
+    if (ctx_->output_pos < ctx_->output_len) {
+      ctx_->output[ctx_->output_pos++] = *cell;
+    } else {
+      bf_ctx_write(ctx_, *cell);
+    }
+  }
+  VisitNextCNode(n);
+}
+
+void CanonInterpreterVisitor::Visit(CLoop* n) {
+  uint64_t trips = RunLoop(n->GetBody());
+  if (profile_) {
+    LoopStats& stats = (*profile_)[n->GetBody()];
+    stats.entries++;
+    stats.trips += trips;
+  }
+  VisitNextCNode(n);
+}
+
+void CanonInterpreterVisitor::Visit(CIf* n) {
+  char* cell = GetCell(0, CELL_READ);
+  if (cell && *cell) {
+    n->GetBody()->Accept(*this);
+  }
+  VisitNextCNode(n);
+}
+
+void CanonInterpreterVisitor::Visit(CCountedLoop* n) {
+  char* cell = GetCell(0, CELL_READ);
+  if (!cell) {
+    return;
+  }
+
+  // Find the trip count by stepping a copy of the cell to zero
+  unsigned char value = *cell;
+  int trips = 0;
+  while (value != 0 && trips < 256) {
+    value += n->GetStep();
+    trips++;
+  }
+  if (value != 0) {
+    // Never reaches zero
+    RunLoop(n->GetBody());
+  } else {
+    // Every back-edge is paid for up front
+    ctx_->steps -= trips;
+    for (int i = 0; i < trips && status_ == BF_OK; i++) {
+      n->GetBody()->Accept(*this);
+    }
+  }
+  VisitNextCNode(n);
+}
+
+void CanonInterpreterVisitor::Visit(CDivMod* n) {
+  char* cell = GetCell(0, CELL_READ);
+  if (!cell || !*cell) {
+    // Neither form touches the other cells
+    VisitNextCNode(n);
+    return;
+  }
+  char* quotient = GetCell(n->GetQuotientOffset(), 0);
+  char* remainder = GetCell(n->GetRemainderOffset(), CELL_READ);
+  char* temp = GetCell(n->GetTempOffset(), CELL_READ);
+  char* second_temp = GetCell(n->GetSecondTempOffset(), CELL_READ);
+  char* divisor_cell = GetCell(n->GetDivisorOffset(), CELL_READ);
+  if (!quotient || !remainder || !temp || !second_temp || !divisor_cell) {
+    return;
+  }
+
+  unsigned divisor = n->GetDivisor();
+  if (n->HasDivisorCell()) {
+    divisor = (unsigned char)*divisor_cell;
+    if (divisor == 0) {
+      divisor = 256;
+    }
+  }
+  if (*remainder == 0 && *temp == 0 && *second_temp == 0 && divisor != 1) {
+    unsigned char value = *cell;
+    *quotient += value / divisor;
+    *remainder = value % divisor;
+    *cell = 0;
+    if (n->HasDivisorCell()) {
+      *divisor_cell = divisor - value % divisor;
+    }
+    if (tape_) {
+      RecordCellAccess(tape_, ptr_ + n->GetQuotientOffset(),
+                       CELL_READ | CELL_WRITE);
+      RecordCellAccess(tape_, ptr_ + n->GetRemainderOffset(), CELL_WRITE);
+      if (n->HasDivisorCell()) {
+        RecordCellAccess(tape_, ptr_ + n->GetDivisorOffset(), CELL_WRITE);
+      }
+      RecordCellAccess(tape_, ptr_, CELL_WRITE);
+    }
+  } else {
+    RunLoop(n->GetBody());
+  }
+  VisitNextCNode(n);
+}
+
+void CanonInterpreterVisitor::Visit(CSetRange* n) {
+  for (int i = 0; i < n->GetCount(); i++) {
+    char* cell = GetCell(n->GetOffset() + i, CELL_WRITE);
+    if (!cell) {
+      return;
+    }
+    *cell = n->GetAmt();
+  }
+  VisitNextCNode(n);
+}
+
+void CanonInterpreterVisitor::Visit(CMoveRange* n) {
+  std::vector<char> moved;
+  for (int i = 0; i < n->GetCount(); i++) {
+    char* cell = GetCell(n->GetOffset() + i, CELL_READ);
+    if (!cell) {
+      return;
+    }
+    moved.push_back(*cell);
+  }
+
+  // Zero the cells the block leaves, then write it at its new place
+  int target = n->GetOffset() + n->GetDistance();
+  for (int i = 0; i < n->GetCount(); i++) {
+    int offset = n->GetOffset() + i;
+    if (offset >= target && offset < target + n->GetCount()) {
+      continue;
+    }
+    char* cell = GetCell(offset, CELL_WRITE);
+    if (!cell) {
+      return;
+    }
+    *cell = 0;
+  }
+  for (int i = 0; i < n->GetCount(); i++) {
+    char* cell = GetCell(target + i, CELL_WRITE);
+    if (!cell) {
+      return;
+    }
+    *cell = moved[i];
+  }
+  VisitNextCNode(n);
+}
+
+BFStatus InterpretCanonIR(CNode* n, BFContext* ctx) {
+  CanonInterpreterVisitor visitor(ctx);
+  if (n) {
+    n->Accept(visitor);
+  }
+  // Checks charges made since the last back-edge, as compiled code does
+  // on return
+  BFStatus status = visitor.GetStatus();
+  if (status == BF_OK && ctx->steps <= 0 && !bf_ctx_refill(ctx, 0)) {
+    status = BF_OUT_OF_STEPS;
+  }
+  return status;
+}
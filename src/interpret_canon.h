@@ -0,0 +1,61 @@
+#ifndef INTERPRET_CANON
+#define INTERPRET_CANON
+
+#include <cstdint>
+
+#include "canon_ir.h"
+#include "cell_access.h"
+#include "loop_profile.h"
+#include "runtime.h"
+#include "tape_profile.h"
+
+// Runs canonical IR directly against a BFContext, with the same I/O and
+// step counting as code compiled from it (the AST path charges scans per
+// trip, so it may stop at a different point)
+// Each node follows the meaning given in canon_ir.h, independently of
+// how codegen lowers it, so it serves as a reference for both
+class CanonInterpreterVisitor : public CNodeVisitor {
+ public:
+  CanonInterpreterVisitor(BFContext* ctx);
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  BFStatus GetStatus() { return status_; }
+  // Counts the entries and trips of every CLoop run into profile
+  void SetProfile(LoopProfile* profile) { profile_ = profile; }
+  // Records the pointer extent and every cell access into tape
+  void SetTapeProfile(TapeProfile* tape) { tape_ = tape; }
+
+ private:
+  void VisitNextCNode(CNode* n);
+  // Returns nullptr and stops the run if the cell is off the tape
+  // access is a CellAccess mask, counted if there is a tape profile
+  char* GetCell(int offset, int access);
+  // Charges a step for a loop back-edge, false once out of steps
+  bool ChargeBackEdge();
+  // Returns the number of times the body ran
+  uint64_t RunLoop(CNode* body);
+  BFContext* ctx_;
+  BodyAccessCache access_cache_;
+  LoopProfile* profile_;
+  TapeProfile* tape_;
+  int64_t ptr_;
+  BFStatus status_;
+};
+
+// Runs n on a context set up with InitContext, starting at the first cell
+// Buffered output is left in the context for the caller to flush
+BFStatus InterpretCanonIR(CNode* n, BFContext* ctx);
+
+#endif  // INTERPRET_CANON
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+
+#include "jit_debug.h"
+
+using namespace llvm;
+
+uint8_t* PerfMapMemoryManager::allocateCodeSection(uintptr_t size,
+                                                   unsigned alignment,
+                                                   unsigned section_id,
+                                                   StringRef section_name) {
+  uint8_t* start = SectionMemoryManager::allocateCodeSection(
+      size, alignment, section_id, section_name);
+  sections_.push_back({reinterpret_cast<uint64_t>(start), size});
+  return start;
+}
+
+bool WritePerfMap(ExecutionEngine* engine, Module* module,
+                  PerfMapMemoryManager* memory_manager, std::string* error) {
+  std::vector<std::pair<uint64_t, std::string>> symbols;
+  for (Function& func : *module) {
+    if (func.isDeclaration()) {
+      continue;
+    }
+    uint64_t address =
+        reinterpret_cast<uint64_t>(engine->getPointerToFunction(&func));
+    if (address) {
+      symbols.push_back(std::make_pair(address, func.getName().str()));
+    }
+  }
+  std::sort(symbols.begin(), symbols.end());
+
+  std::string path = "/tmp/perf-" + std::to_string(getpid()) + ".map";
+  std::ofstream out(path, std::ios::app);
+  if (!out) {
+    *error = "Can't write " + path;
+    return false;
+  }
+  out << std::hex;
+  for (size_t i = 0; i < symbols.size(); i++) {
+    uint64_t start = symbols[i].first;
+    uint64_t end = start;
+    for (auto& section : memory_manager->GetCodeSections()) {
+      if (start >= section.start && start < section.start + section.size) {
+        end = section.start + section.size;
+      }
+    }
+    if (i + 1 < symbols.size()) {
+      end = std::min(end, symbols[i + 1].first);
+    }
+    out << start << " " << end - start << " bf:" << symbols[i].second
+        << std::endl;
+  }
+  return true;
+}
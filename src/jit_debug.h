@@ -0,0 +1,37 @@
+#ifndef JIT_DEBUG
+#define JIT_DEBUG
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/Module.h"
+
+// Remembers where the JIT put each code section, so that functions can
+// be given sizes for a perf map
+class PerfMapMemoryManager : public llvm::SectionMemoryManager {
+ public:
+  uint8_t* allocateCodeSection(uintptr_t size, unsigned alignment,
+                               unsigned section_id,
+                               llvm::StringRef section_name) override;
+
+  struct CodeSection {
+    uint64_t start;
+    uint64_t size;
+  };
+  const std::vector<CodeSection>& GetCodeSections() { return sections_; }
+
+ private:
+  std::vector<CodeSection> sections_;
+};
+
+// Appends a line per function defined in module to /tmp/perf-<pid>.map,
+// where perf looks up symbols for JIT code
+// A function runs up to the next one or the end of its section
+// Returns false and sets error if the file can't be written
+bool WritePerfMap(llvm::ExecutionEngine* engine, llvm::Module* module,
+                  PerfMapMemoryManager* memory_manager, std::string* error);
+
+#endif  // JIT_DEBUG
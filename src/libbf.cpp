@@ -0,0 +1,123 @@
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/TargetSelect.h"
+
+#include "parser.h"
+#include "canon_ir.h"
+#include "canon_translate.h"
+#include "codegen_ast.h"
+#include "codegen_canon.h"
+#include "optimize.h"
+#include "runtime.h"
+#include "libbf.h"
+
+using namespace llvm;
+
+BFProgram::BFProgram() {
+  entry_ = nullptr;
+  store_size_ = 0;
+}
+
+BFProgram::~BFProgram() {}
+
+// The parser exits on unbalanced loops, which a library must not do
+bool BFCheckLoops(const std::string& source, std::string* error) {
+  int depth = 0;
+  for (char c : source) {
+    if (c == '[') {
+      depth++;
+    } else if (c == ']' && --depth < 0) {
+      *error = "Unmatched end-loop";
+      return false;
+    }
+  }
+  if (depth > 0) {
+    *error = "Unmatched start-loop";
+    return false;
+  }
+  return true;
+}
+
+BFProgram* BFCompile(const std::string& source, const BFOptions& options,
+                     std::string* error) {
+  if (!BFCheckLoops(source, error)) {
+    return nullptr;
+  }
+
+  std::istringstream source_stream(source);
+  std::unique_ptr<ASTNode> prog(Parse(source_stream));
+  std::unique_ptr<Module> module(new Module("bfcode", getGlobalContext()));
+  Function* func;
+  CodeGenOptions codegen_options;
+  codegen_options.store_size = options.store_size;
+  codegen_options.abi = ABI_CONTEXT;
+  codegen_options.count_steps = options.count_steps;
+
+  if (options.optimize_bf) {
+    std::unique_ptr<CNode> canon_prog(TranslateASTToCanonIR(prog.get()));
+    canon_prog.reset(OptimizeCanonIR(canon_prog.get()));
+    func = BuildProgramFromCanon(canon_prog.get(), module.get(),
+                                 codegen_options);
+  } else {
+    func = BuildProgramFromAST(prog.get(), module.get(), codegen_options);
+  }
+
+  if (options.optimize_llvm) {
+    OptimizeLLVM(module.get(), func);
+  }
+
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  InitializeNativeTargetAsmParser();
+
+  // The host may not export the runtime, so resolve it explicitly
+  sys::DynamicLibrary::AddSymbol("bf_ctx_read", (void*)&bf_ctx_read);
+  sys::DynamicLibrary::AddSymbol("bf_ctx_write", (void*)&bf_ctx_write);
+  sys::DynamicLibrary::AddSymbol("bf_ctx_refill", (void*)&bf_ctx_refill);
+
+  std::string engine_error;
+  ExecutionEngine* engine =
+      EngineBuilder(std::move(module))
+          .setErrorStr(&engine_error)
+          .setMCJITMemoryManager(llvm::make_unique<SectionMemoryManager>())
+          .create();
+  if (!engine) {
+    *error = "Engine not created: " + engine_error;
+    return nullptr;
+  }
+  engine->finalizeObject();
+
+  BFProgram* program = new BFProgram();
+  program->engine_.reset(engine);
+  program->entry_ = (int (*)(BFContext*))engine->getPointerToFunction(func);
+  program->store_size_ = options.store_size;
+  return program;
+}
+
+BFStatus BFRunContext(BFProgram* program, BFContext* ctx) {
+  return (BFStatus)program->entry_(ctx);
+}
+
+BFStatus BFRun(BFProgram* program, const char* input, size_t input_len,
+               BFOutputSink sink, void* user, uint64_t max_steps,
+               double max_seconds) {
+  std::vector<char> tape(program->GetStoreSize());
+  char output[4096];
+  BFContext ctx;
+  InitContext(&ctx, tape.data(), tape.size(), input, input_len, output,
+              sizeof(output), sink, user);
+  SetBudget(&ctx, max_steps, max_seconds);
+  BFStatus status = BFRunContext(program, &ctx);
+  FlushContext(&ctx);
+  return status;
+}
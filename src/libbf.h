@@ -0,0 +1,63 @@
+#ifndef LIBBF
+#define LIBBF
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "runtime.h"
+
+namespace llvm {
+class ExecutionEngine;
+}
+
+struct BFOptions {
+  bool optimize_bf = false;
+  bool optimize_llvm = false;
+  unsigned store_size = 10000;
+  // Count loop back-edges so runs can be given a step budget
+  bool count_steps = false;
+};
+
+// A JIT-compiled program; it can be run any number of times
+// Generated code keeps all of its state in the BFContext it is given,
+// so a program may run on many threads at once with distinct contexts
+class BFProgram {
+ public:
+  BFProgram();
+  ~BFProgram();
+  unsigned GetStoreSize() { return store_size_; }
+
+ private:
+  friend BFProgram* BFCompile(const std::string& source,
+                              const BFOptions& options, std::string* error);
+  friend BFStatus BFRunContext(BFProgram* program, BFContext* ctx);
+  std::unique_ptr<llvm::ExecutionEngine> engine_;
+  int (*entry_)(BFContext* ctx);
+  unsigned store_size_;
+};
+
+// Returns false and sets error if the loops in source are unbalanced
+bool BFCheckLoops(const std::string& source, std::string* error);
+
+// Compiles source for embedding
+// Returns NULL and sets error if the program could not be compiled
+BFProgram* BFCompile(const std::string& source, const BFOptions& options,
+                     std::string* error);
+
+// Runs program on a context set up with InitContext
+// The tape must be zeroed and at least GetStoreSize() cells long
+// Buffered output is left in the context for the caller to flush
+BFStatus BFRunContext(BFProgram* program, BFContext* ctx);
+
+// Runs program reading input in place from [input, input + input_len)
+// Output is passed to sink in chunks, in order
+// A non-zero max_steps or max_seconds stops the run with BF_OUT_OF_STEPS
+// after that many loop iterations or that much time, if the program was
+// compiled with count_steps; output up to that point is kept
+BFStatus BFRun(BFProgram* program, const char* input, size_t input_len,
+               BFOutputSink sink, void* user, uint64_t max_steps = 0,
+               double max_seconds = 0);
+
+#endif  // LIBBF
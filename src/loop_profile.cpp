@@ -0,0 +1,101 @@
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "canon_ir.h"
+#include "loop_profile.h"
+
+static const char* kProfileHeader = "bf-loop-profile";
+
+void LoopListVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  }
+}
+
+void LoopListVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void LoopListVisitor::Visit(CPtrMov* n) { VisitNextCNode(n); }
+
+void LoopListVisitor::Visit(CAdd* n) { VisitNextCNode(n); }
+
+void LoopListVisitor::Visit(CMul* n) { VisitNextCNode(n); }
+
+void LoopListVisitor::Visit(CSet* n) { VisitNextCNode(n); }
+
+void LoopListVisitor::Visit(CInput* n) { VisitNextCNode(n); }
+
+void LoopListVisitor::Visit(COutput* n) { VisitNextCNode(n); }
+
+void LoopListVisitor::Visit(CLoop* n) {
+  loops_.push_back(n->GetBody());
+  n->GetBody()->Accept(*this);
+  VisitNextCNode(n);
+}
+
+void LoopListVisitor::Visit(CIf* n) {
+  n->GetBody()->Accept(*this);
+  VisitNextCNode(n);
+}
+
+void LoopListVisitor::Visit(CCountedLoop* n) {
+  n->GetBody()->Accept(*this);
+  VisitNextCNode(n);
+}
+
+void LoopListVisitor::Visit(CDivMod* n) {
+  n->GetBody()->Accept(*this);
+  VisitNextCNode(n);
+}
+
+void LoopListVisitor::Visit(CSetRange* n) { VisitNextCNode(n); }
+
+void LoopListVisitor::Visit(CMoveRange* n) { VisitNextCNode(n); }
+
+bool SaveLoopProfile(CNode* n, const LoopProfile& profile,
+                     const std::string& path, std::string* error) {
+  LoopListVisitor list;
+  n->Accept(list);
+  std::ofstream out(path);
+  if (!out) {
+    *error = "Can't write " + path;
+    return false;
+  }
+
+  // One line of entries and trips per loop, in program order
+  out << kProfileHeader << " " << list.GetLoops().size() << std::endl;
+  for (CNode* body : list.GetLoops()) {
+    auto it = profile.find(body);
+    LoopStats stats = it == profile.end() ? LoopStats() : it->second;
+    out << stats.entries << " " << stats.trips << std::endl;
+  }
+  return true;
+}
+
+bool LoadLoopProfile(CNode* n, const std::string& path, LoopProfile* profile,
+                     std::string* error) {
+  LoopListVisitor list;
+  n->Accept(list);
+  std::ifstream in(path);
+  std::string header;
+  size_t count;
+  if (!(in >> header >> count) || header != kProfileHeader) {
+    *error = "Can't read a loop profile from " + path;
+    return false;
+  }
+  if (count != list.GetLoops().size()) {
+    *error = "Loop profile " + path + " was recorded on another program";
+    return false;
+  }
+
+  for (CNode* body : list.GetLoops()) {
+    LoopStats stats;
+    if (!(in >> stats.entries >> stats.trips)) {
+      *error = "Loop profile " + path + " is truncated";
+      return false;
+    }
+    (*profile)[body] = stats;
+  }
+  return true;
+}
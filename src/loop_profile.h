@@ -0,0 +1,54 @@
+#ifndef LOOP_PROFILE
+#define LOOP_PROFILE
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "canon_ir.h"
+
+struct LoopStats {
+  // Times the loop was reached
+  uint64_t entries = 0;
+  // Times its body ran, over all entries
+  uint64_t trips = 0;
+};
+
+// Stats for each CLoop, by body
+typedef std::map<CNode*, LoopStats> LoopProfile;
+
+// Lists the bodies of the CLoops in a program in order, each loop
+// before the loops inside it
+class LoopListVisitor : public CNodeVisitor {
+ public:
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  const std::vector<CNode*>& GetLoops() { return loops_; }
+
+ private:
+  void VisitNextCNode(CNode* n);
+  std::vector<CNode*> loops_;
+};
+
+// Profiles are stored by loop number, so they only apply to the program
+// they were recorded on, optimized the same way
+// Both return false and set error if the file can't be used
+bool SaveLoopProfile(CNode* n, const LoopProfile& profile,
+                     const std::string& path, std::string* error);
+bool LoadLoopProfile(CNode* n, const std::string& path, LoopProfile* profile,
+                     std::string* error);
+
+#endif  // LOOP_PROFILE
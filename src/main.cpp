@@ -5,28 +5,51 @@
 #include <fcntl.h>
 #include <memory>
 #include <system_error>
+#include <iterator>
+#include <algorithm>
+#include <iomanip>
+#include <map>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <random>
+#include <sstream>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
 
-#include "llvm/Analysis/Passes.h"
 #include "llvm/ExecutionEngine/ExecutionEngine.h"
 #include "llvm/ExecutionEngine/MCJIT.h"
 #include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
-#include "llvm/IR/Verifier.h"
-#include "llvm/PassManager.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/raw_ostream.h"
-#include "llvm/Transforms/Scalar.h"
 
 #include "parser.h"
+#include "batch.h"
 #include "canon_ir.h"
+#include "canon_file.h"
 #include "canon_translate.h"
 #include "codegen_ast.h"
+#include "codegen_c.h"
 #include "codegen_canon.h"
-#include "canonicalize_basic_blocks.h"
-#include "eliminate_simple_loops.h"
+#include "compact_ir.h"
+#include "differential.h"
+#include "interpret_canon.h"
+#include "jit_debug.h"
+#include "libbf.h"
+#include "loop_profile.h"
+#include "mapped_io.h"
+#include "optimize.h"
+#include "parallel_compile.h"
+#include "perf_stats.h"
 #include "print_canon.h"
+#include "scale_program.h"
+#include "static_position.h"
+#include "stream_compile.h"
+#include "tape_profile.h"
 
 using namespace std;
 using namespace llvm;
@@ -39,22 +62,541 @@ void help(char* argv[]) {
   cerr << "  -O          Apply BF-specific optimizations" << endl;
   cerr << "  -L          Apply LLVM optimizations" << endl;
   cerr << "  -p          Print new program to stderr" << endl;
+  cerr << "  -C          Compiles a chunk at a time, holding the IR of at"
+       << endl;
+  cerr << "              most one top-level loop (ignores -p)" << endl;
   cerr << "  -o outfile  Outputs llvm code to outfile" << endl;
+  cerr << "  -c outfile  Outputs C code to outfile instead, for any C compiler"
+       << endl;
   cerr << "  -s size     Set the size of the bf tape (default 10000)" << endl;
+  cerr << "  -R size     With -O, emit repeated loops of at least size"
+       << endl;
+  cerr << "              instructions once, as shared functions (default 16,"
+       << endl;
+  cerr << "              0 inlines every loop)" << endl;
+  cerr << "  -B inputs   Runs on each file in a directory, or on each" << endl;
+  cerr << "              NUL-separated input in a file (- for stdin)" << endl;
+  cerr << "  -j workers  Threads used by -B and -P (default: one per core)"
+       << endl;
+  cerr << "  -t steps    Stops each -B, -i, -I or -W run after steps loop"
+       << endl;
+  cerr << "              iterations" << endl;
+  cerr << "  -T seconds  Stops each -B, -i, -I or -W run after seconds of"
+       << endl;
+  cerr << "              wall time" << endl;
+  cerr << "  -P          JIT compiles each top-level region on its own,"
+       << endl;
+  cerr << "              on -j threads, and runs the program" << endl;
+  cerr << "  -G profile  Interprets the -O program with input from stdin,"
+       << endl;
+  cerr << "              recording loop counts to profile" << endl;
+  cerr << "  -U profile  With -O, uses loop counts from profile for branch"
+       << endl;
+  cerr << "              weights, unrolling and register promotion" << endl;
+  cerr << "  -I infile   Runs with input mapped from infile (- for stdin)"
+       << endl;
+  cerr << "  -W outfile  Runs with output buffered in bulk to outfile;"
+       << endl;
+  cerr << "              without -I, input is read from stdin as needed"
+       << endl;
+  cerr << "  -D          Checks that every compilation path agrees on the"
+       << endl;
+  cerr << "              output and final tape, with input from stdin" << endl;
+  cerr << "  -F count    Checks count random programs instead of a file"
+       << endl;
+  cerr << "  -S seed     Seed for -F (default: random)" << endl;
+  cerr << "  -M limit    Parses into the compact IR and fails if peak RSS"
+       << endl;
+  cerr << "              grows by more than limit MB per MB of source" << endl;
+  cerr << "  -g          With -i, writes /tmp/perf-<pid>.map for perf; with -O,"
+       << endl;
+  cerr << "              also adds line info against a dump of the program"
+       << endl;
+  cerr << "              in /tmp/bf-<pid>.canon" << endl;
+  cerr << "  --perf-stats  Reports hardware counters, I/O bytes and syscalls"
+       << endl;
+  cerr << "              for the compile and execute phases" << endl;
+  cerr << "  --save-ir file  Saves the canonical IR (with -O, optimized) to"
+       << endl;
+  cerr << "              file in binary; --save-ir-text saves it as text"
+       << endl;
+  cerr << "  --load-ir   The input file is saved IR, used without running"
+       << endl;
+  cerr << "              the -O passes again" << endl;
+  cerr << "  --tape-map report  Interprets the program with input from stdin,"
+       << endl;
+  cerr << "              writing the pointer extent and per-cell reads and"
+       << endl;
+  cerr << "              writes to report (with -O, of the optimized program)"
+       << endl;
+  cerr << "  --scale-bench size  Times each compiler phase on generated"
+       << endl;
+  cerr << "              programs of doubling length up to size, failing if"
+       << endl;
+  cerr << "              one grows much faster than the program" << endl;
   cerr << "  -h          Displays this help message" << endl;
 }
 
+// Runs the program over every input, writing outputs in input order to
+// stdout and timings to stderr
+// Runs over budget keep the output they produced and are reported as
+// stopped
+int RunBatchMode(const char* source_path, const char* inputs_path,
+                 const BFOptions& options, unsigned workers,
+                 uint64_t max_steps, double max_seconds) {
+  ifstream source_file(source_path);
+  std::string source((istreambuf_iterator<char>(source_file)),
+                     istreambuf_iterator<char>());
+  std::string error;
+
+  auto start = chrono::steady_clock::now();
+  std::unique_ptr<BFProgram> program(BFCompile(source, options, &error));
+  if (!program) {
+    cerr << error << endl;
+    return -1;
+  }
+  chrono::duration<double> compile_time = chrono::steady_clock::now() - start;
+
+  std::vector<BatchInput> inputs;
+  if (!ReadBatchInputs(inputs_path, &inputs, &error)) {
+    cerr << error << endl;
+    return -1;
+  }
+
+  start = chrono::steady_clock::now();
+  std::vector<BatchResult> results =
+      RunBatch(program.get(), inputs, workers, max_steps, max_seconds);
+  chrono::duration<double> run_time = chrono::steady_clock::now() - start;
+
+  cerr << fixed << setprecision(3);
+  cerr << "compile\t" << compile_time.count() * 1000 << " ms" << endl;
+  for (size_t i = 0; i < results.size(); i++) {
+    cout.write(results[i].output.data(), results[i].output.size());
+    cerr << inputs[i].name << "\t"
+         << (results[i].status == BF_OK ? "ok" : "stopped") << "\t"
+         << results[i].seconds * 1000 << " ms" << endl;
+  }
+  cerr << "total\t" << results.size() << " runs in " << run_time.count() * 1000
+       << " ms on " << workers << " workers" << endl;
+  return 0;
+}
+
+// Output is handed to the file in chunks of this size
+static const size_t kMappedOutputSize = 1 << 20;
+
+// Runs the program with input read in place from a mapped file and
+// output written in large chunks, rather than a byte at a time through
+// stdio
+// Without an input file, input is read from stdin as the program asks
+// for it, so interactive programs still work
+// A run over budget keeps the output it produced and fails
+int RunMappedMode(const char* source_path, const char* input_path,
+                  const char* output_path, const BFOptions& options,
+                  uint64_t max_steps, double max_seconds) {
+  ifstream source_file(source_path);
+  std::string source((istreambuf_iterator<char>(source_file)),
+                     istreambuf_iterator<char>());
+  std::string error;
+  std::unique_ptr<BFProgram> program(BFCompile(source, options, &error));
+  if (!program) {
+    cerr << error << endl;
+    return -1;
+  }
+
+  MappedInput input;
+  if (input_path && !input.Open(input_path, &error)) {
+    cerr << error << endl;
+    return -1;
+  }
+
+  int fd = STDOUT_FILENO;
+  if (output_path) {
+    fd = open(output_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+      cerr << "Can't open " << output_path << endl;
+      return -1;
+    }
+  }
+
+  std::vector<char> tape(program->GetStoreSize());
+  std::vector<char> output(kMappedOutputSize);
+  BFContext ctx;
+  InitContext(&ctx, tape.data(), tape.size(), input.GetData(),
+              input.GetSize(), output.data(), output.size(), WriteToFd, &fd);
+  if (!input_path) {
+    SetInputSource(&ctx, ReadFromStdin);
+  }
+  SetBudget(&ctx, max_steps, max_seconds);
+  BFStatus status = BFRunContext(program.get(), &ctx);
+  FlushContext(&ctx);
+
+  if (fd != STDOUT_FILENO) {
+    close(fd);
+  }
+  if (status == BF_OUT_OF_STEPS) {
+    cerr << "Stopped after running out of steps" << endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Compiles the regions of the program concurrently, reporting how long
+// that took, then runs it
+int RunParallelMode(const char* source_path, const BFOptions& options,
+                    unsigned workers) {
+  ifstream source_file(source_path);
+  std::string error;
+  auto start = chrono::steady_clock::now();
+  std::unique_ptr<RegionProgram> program(
+      CompileRegions(source_file, options, workers, &error));
+  if (!program) {
+    cerr << error << endl;
+    return -1;
+  }
+  chrono::duration<double> compile_time = chrono::steady_clock::now() - start;
+  cerr << fixed << setprecision(3) << "compile\t"
+       << compile_time.count() * 1000 << " ms, " << program->GetRegionCount()
+       << " regions on " << workers << " workers" << endl;
+
+  program->Run();
+  return 0;
+}
+
+// Returns the canonical IR of the program at path, which is either a file
+// written by SaveCanonIR, used as it is, or source, optimized by the
+// canonical IR passes if optimize_bf is set
+// Returns NULL and prints why if a saved file can't be read
+CNode* ReadCanonProgram(const char* path, bool load_ir, bool optimize_bf) {
+  if (load_ir) {
+    std::string error;
+    CNode* canon_prog = LoadCanonIR(path, &error);
+    if (!canon_prog) {
+      cerr << error << endl;
+    }
+    return canon_prog;
+  }
+  ifstream source_file(path);
+  std::unique_ptr<ASTNode> prog(Parse(source_file));
+  std::unique_ptr<CNode> canon_prog(TranslateASTToCanonIR(prog.get()));
+  if (optimize_bf) {
+    canon_prog.reset(OptimizeCanonIR(canon_prog.get()));
+  }
+  return canon_prog.release();
+}
+
+// Saves the canonical IR of the program, optimized if optimize_bf is set
+int RunSaveIRMode(const char* source_path, const char* ir_path, bool text,
+                  bool optimize_bf) {
+  std::unique_ptr<CNode> canon_prog(
+      ReadCanonProgram(source_path, false, optimize_bf));
+  std::string error;
+  if (!SaveCanonIR(canon_prog.get(), ir_path, text, &error)) {
+    cerr << error << endl;
+    return -1;
+  }
+  return 0;
+}
+
+// Writes the program as C, optimized by the canonical IR passes if
+// optimize_bf is set
+int RunCMode(const char* source_path, const char* c_path, bool load_ir,
+             bool optimize_bf, unsigned store_size) {
+  std::unique_ptr<CNode> canon_prog(
+      ReadCanonProgram(source_path, load_ir, optimize_bf));
+  if (!canon_prog) {
+    return -1;
+  }
+  ofstream c_file(c_path);
+  if (!c_file) {
+    cerr << "Can't write " << c_path << endl;
+    return -1;
+  }
+  PrintCProgram(canon_prog.get(), c_file, store_size);
+  return 0;
+}
+
+// Runs the optimized program in the interpreter, counting how often each
+// loop is entered and iterated
+int RunProfileMode(const char* source_path, const char* profile_path,
+                   bool load_ir, unsigned store_size) {
+  std::unique_ptr<CNode> canon_prog(
+      ReadCanonProgram(source_path, load_ir, true));
+  if (!canon_prog) {
+    return -1;
+  }
+  std::string input((istreambuf_iterator<char>(cin)),
+                    istreambuf_iterator<char>());
+
+  std::vector<char> tape(store_size);
+  std::vector<char> output(kMappedOutputSize);
+  int fd = STDOUT_FILENO;
+  BFContext ctx;
+  InitContext(&ctx, tape.data(), tape.size(), input.data(), input.size(),
+              output.data(), output.size(), WriteToFd, &fd);
+  LoopProfile profile;
+  CanonInterpreterVisitor interpreter(&ctx);
+  interpreter.SetProfile(&profile);
+  canon_prog->Accept(interpreter);
+  FlushContext(&ctx);
+  if (interpreter.GetStatus() != BF_OK) {
+    cerr << "Program ran off the tape" << endl;
+    return -1;
+  }
+
+  std::string error;
+  if (!SaveLoopProfile(canon_prog.get(), profile, profile_path, &error)) {
+    cerr << error << endl;
+    return -1;
+  }
+  return 0;
+}
+
+// Runs the program in the interpreter, counting accesses to each cell
+int RunTapeMode(const char* source_path, const char* report_path,
+                bool load_ir, bool optimize, unsigned store_size) {
+  std::unique_ptr<CNode> canon_prog(
+      ReadCanonProgram(source_path, load_ir, optimize));
+  if (!canon_prog) {
+    return -1;
+  }
+  std::string input((istreambuf_iterator<char>(cin)),
+                    istreambuf_iterator<char>());
+
+  std::vector<char> tape(store_size);
+  std::vector<char> output(kMappedOutputSize);
+  int fd = STDOUT_FILENO;
+  BFContext ctx;
+  InitContext(&ctx, tape.data(), tape.size(), input.data(), input.size(),
+              output.data(), output.size(), WriteToFd, &fd);
+  TapeProfile profile;
+  CanonInterpreterVisitor interpreter(&ctx);
+  interpreter.SetTapeProfile(&profile);
+  canon_prog->Accept(interpreter);
+  FlushContext(&ctx);
+
+  // The report is still written, since it shows how far the program got
+  std::string error;
+  if (!SaveTapeReport(profile, report_path, &error)) {
+    cerr << error << endl;
+    return -1;
+  }
+  if (interpreter.GetStatus() != BF_OK) {
+    cerr << "Program ran off the tape" << endl;
+    return -1;
+  }
+  return 0;
+}
+
+// Runs the file through every compilation path and reports the first
+// difference
+int RunDifferentialMode(const char* source_path, unsigned store_size) {
+  ifstream source_file(source_path);
+  std::string source((istreambuf_iterator<char>(source_file)),
+                     istreambuf_iterator<char>());
+  std::string input((istreambuf_iterator<char>(cin)),
+                    istreambuf_iterator<char>());
+
+  std::string report;
+  switch (CheckEquivalence(source, input, store_size, 0, &report)) {
+    case DIFF_SAME:
+      cerr << "All paths agree" << endl;
+      return 0;
+    case DIFF_SKIPPED:
+      cerr << "Skipped: " << report << endl;
+      return 0;
+    case DIFF_MISMATCH:
+      cerr << "Mismatch in " << report << endl;
+      return 1;
+  }
+  return 1;
+}
+
+// Peak resident set size of the process so far, in bytes
+static size_t GetPeakRSS() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss * 1024;
+}
+
+// Parses the file into the compact IR and then into the pointer-based
+// trees, reporting the memory each costs per MB of source
+// The compact parse goes first, since peak RSS only ever grows
+int RunMemoryMode(const char* source_path, double limit) {
+  ifstream source_file(source_path, ios::ate);
+  double source_mb = static_cast<double>(source_file.tellg()) / (1 << 20);
+  source_file.seekg(0);
+  if (source_mb <= 0) {
+    cerr << "Empty or unreadable source" << endl;
+    return -1;
+  }
+
+  size_t base_rss = GetPeakRSS();
+  CompactProgram compact;
+  std::string error;
+  if (!ParseCompact(source_file, &compact, &error)) {
+    cerr << error << endl;
+    return -1;
+  }
+  double compact_rss = (GetPeakRSS() - base_rss) / double(1 << 20);
+
+  source_file.clear();
+  source_file.seekg(0);
+  base_rss = GetPeakRSS();
+  std::unique_ptr<ASTNode> prog(Parse(source_file));
+  std::unique_ptr<CNode> canon_prog(TranslateASTToCanonIR(prog.get()));
+  double tree_rss = (GetPeakRSS() - base_rss) / double(1 << 20);
+
+  cerr << fixed << setprecision(2);
+  cerr << "source\t" << source_mb << " MB, " << compact.Size()
+       << " instructions" << endl;
+  cerr << "compact\t" << compact.GetMemoryUsage() / double(1 << 20) / source_mb
+       << " MB held, " << compact_rss / source_mb
+       << " MB peak RSS, per MB of source" << endl;
+  cerr << "tree\t" << tree_rss / source_mb
+       << " MB peak RSS, per MB of source" << endl;
+
+  if (compact_rss / source_mb > limit) {
+    cerr << "Over budget of " << limit << " MB per MB of source" << endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Generated programs start at this many characters and double
+static const unsigned kMinScaleSize = 1 << 10;
+// A phase whose time grows by more than 2^kMaxScaleExponent when the
+// program doubles is reported, unless it stays under kMinScaleSeconds
+static const double kMaxScaleExponent = 1.5;
+static const double kMinScaleSeconds = 0.01;
+// Each size is compiled this many times and the fastest time of each
+// phase kept, so that one slow run does not look like growth
+static const int kScaleRepeats = 3;
+
+// Compiles each generated program shape at doubling sizes, printing the
+// time spent in each phase and the peak RSS so far
+// Returns 1 if a phase grew superlinearly between the two largest sizes
+int RunScaleMode(unsigned max_size) {
+  const char* kPhases[] = {"parse", "passes", "codegen", "llvm"};
+  const int kPhaseCount = 4;
+  int superlinear = 0;
+
+  cerr << fixed << setprecision(2);
+  cerr << "shape\tsize";
+  for (const char* phase : kPhases) {
+    cerr << "\t" << phase << " ms";
+  }
+  cerr << "\tpeak MB" << endl;
+
+  for (int s = 0; s < SCALE_SHAPE_COUNT; s++) {
+    ScaleShape shape = static_cast<ScaleShape>(s);
+    double previous[kPhaseCount] = {};
+    double current[kPhaseCount] = {};
+    for (unsigned size = kMinScaleSize; size <= max_size; size *= 2) {
+      std::copy(current, current + kPhaseCount, previous);
+      std::string text = GenerateScaleProgram(shape, size);
+      for (int repeat = 0; repeat < kScaleRepeats; repeat++) {
+        std::istringstream source(text);
+        auto start = chrono::steady_clock::now();
+        std::unique_ptr<ASTNode> prog(Parse(source));
+        auto parsed = chrono::steady_clock::now();
+        std::unique_ptr<CNode> canon_prog(TranslateASTToCanonIR(prog.get()));
+        canon_prog.reset(OptimizeCanonIR(canon_prog.get()));
+        auto optimized = chrono::steady_clock::now();
+        std::unique_ptr<Module> module(
+            new Module("bfcode", getGlobalContext()));
+        Function* func = BuildProgramFromCanon(canon_prog.get(), module.get(),
+                                               CodeGenOptions());
+        auto generated = chrono::steady_clock::now();
+        OptimizeLLVM(module.get(), func);
+        auto done = chrono::steady_clock::now();
+
+        double times[kPhaseCount] = {
+            chrono::duration<double>(parsed - start).count(),
+            chrono::duration<double>(optimized - parsed).count(),
+            chrono::duration<double>(generated - optimized).count(),
+            chrono::duration<double>(done - generated).count()};
+        for (int i = 0; i < kPhaseCount; i++) {
+          if (repeat == 0 || times[i] < current[i]) {
+            current[i] = times[i];
+          }
+        }
+      }
+      cerr << GetScaleShapeName(shape) << "\t" << size;
+      for (double seconds : current) {
+        cerr << "\t" << seconds * 1000;
+      }
+      cerr << "\t" << GetPeakRSS() / double(1 << 20) << endl;
+    }
+
+    for (int i = 0; i < kPhaseCount; i++) {
+      if (previous[i] <= 0 || current[i] < kMinScaleSeconds) {
+        continue;
+      }
+      double exponent = log2(current[i] / previous[i]);
+      if (exponent > kMaxScaleExponent) {
+        cerr << GetScaleShapeName(shape) << ": " << kPhases[i]
+             << " grows as size^" << exponent << endl;
+        superlinear = 1;
+      }
+    }
+  }
+  return superlinear;
+}
+
 int main(int argc, char* argv[]) {
   bool interpret_flag = false;
   bool output_flag = false;
   bool optimize_bf_flag = false;
   bool optimize_llvm_flag = false;
   bool print_flag = false;
+  bool differential_flag = false;
+  bool stream_flag = false;
+  bool parallel_flag = false;
+  double memory_limit = 0;
+  uint64_t max_steps = 0;
+  double max_seconds = 0;
+  unsigned fuzz_count = 0;
+  unsigned fuzz_seed = random_device()();
   char* output_file;
+  char* batch_inputs = NULL;
+  char* mapped_input = NULL;
+  char* mapped_output = NULL;
+  char* profile_output = NULL;
+  char* profile_input = NULL;
+  char* c_output = NULL;
   unsigned store_size = 10000;
+  unsigned outline_min_size = CodeGenOptions().outline_min_size;
+  unsigned workers = max(1u, thread::hardware_concurrency());
+
+  bool perf_stats_flag = false;
+  unsigned scale_max_size = 0;
+  char* tape_report = NULL;
+  char* save_ir = NULL;
+  bool save_ir_text = false;
+  bool load_ir_flag = false;
+  bool debug_flag = false;
+
+  // Long options get values outside the range of short ones
+  const int kPerfStatsOption = 256;
+  const int kScaleBenchOption = 257;
+  const int kTapeMapOption = 258;
+  const int kSaveIROption = 259;
+  const int kSaveIRTextOption = 260;
+  const int kLoadIROption = 261;
+  static const struct option long_options[] = {
+      {"perf-stats", no_argument, NULL, kPerfStatsOption},
+      {"scale-bench", required_argument, NULL, kScaleBenchOption},
+      {"tape-map", required_argument, NULL, kTapeMapOption},
+      {"save-ir", required_argument, NULL, kSaveIROption},
+      {"save-ir-text", required_argument, NULL, kSaveIRTextOption},
+      {"load-ir", no_argument, NULL, kLoadIROption},
+      {NULL, 0, NULL, 0}};
+
+  const char* short_options = "ps:iho:c:OLB:j:t:T:DF:S:I:W:M:CPR:G:U:g";
 
-  char option_char;
-  while ((option_char = getopt(argc, argv, "ps:iho:OL")) != EOF) {
+  int option_char;
+  while ((option_char = getopt_long(argc, argv, short_options, long_options,
+                                    NULL)) != EOF) {
     switch (option_char) {
       case 'p':
         print_flag = true;
@@ -69,6 +611,9 @@ int main(int argc, char* argv[]) {
         output_flag = true;
         output_file = optarg;
         break;
+      case 'c':
+        c_output = optarg;
+        break;
       case 'h':
         help(argv);
         return 0;
@@ -78,65 +623,227 @@ int main(int argc, char* argv[]) {
       case 'L':
         optimize_llvm_flag = true;
         break;
+      case 'B':
+        batch_inputs = optarg;
+        break;
+      case 'j':
+        workers = max(1, atoi(optarg));
+        break;
+      case 'I':
+        mapped_input = optarg;
+        break;
+      case 'W':
+        mapped_output = optarg;
+        break;
+      case 'D':
+        differential_flag = true;
+        break;
+      case 'F':
+        fuzz_count = atoi(optarg);
+        break;
+      case 'S':
+        fuzz_seed = strtoul(optarg, NULL, 10);
+        break;
+      case 'M':
+        memory_limit = atof(optarg);
+        break;
+      case 't':
+        max_steps = strtoull(optarg, NULL, 10);
+        break;
+      case 'T':
+        max_seconds = atof(optarg);
+        break;
+      case 'C':
+        stream_flag = true;
+        break;
+      case 'P':
+        parallel_flag = true;
+        break;
+      case 'R':
+        outline_min_size = atoi(optarg);
+        break;
+      case 'G':
+        profile_output = optarg;
+        break;
+      case 'U':
+        profile_input = optarg;
+        break;
+      case 'g':
+        debug_flag = true;
+        break;
+      case kPerfStatsOption:
+        perf_stats_flag = true;
+        break;
+      case kScaleBenchOption:
+        scale_max_size = atoi(optarg);
+        break;
+      case kTapeMapOption:
+        tape_report = optarg;
+        break;
+      case kSaveIROption:
+      case kSaveIRTextOption:
+        save_ir = optarg;
+        save_ir_text = option_char == kSaveIRTextOption;
+        break;
+      case kLoadIROption:
+        load_ir_flag = true;
+        break;
       default:
         help(argv);
         return -1;
     }
   }
 
+  if (scale_max_size > 0) {
+    return RunScaleMode(scale_max_size);
+  }
+
+  if (fuzz_count > 0) {
+    return FuzzOptimizer(fuzz_count, fuzz_seed, store_size, cerr) > 0;
+  }
+
   if (optind == argc) {
     help(argv);
     return -1;
   }
 
+  if (load_ir_flag && (stream_flag || parallel_flag || batch_inputs ||
+                       mapped_input || mapped_output || differential_flag ||
+                       memory_limit > 0)) {
+    cerr << "--load-ir can't be used with -C, -P, -B, -I, -W, -D or -M"
+         << endl;
+    return -1;
+  }
+
+  if (memory_limit > 0) {
+    return RunMemoryMode(argv[optind], memory_limit);
+  }
+
+  if (save_ir) {
+    return RunSaveIRMode(argv[optind], save_ir, save_ir_text,
+                         optimize_bf_flag);
+  }
+
+  if (c_output) {
+    return RunCMode(argv[optind], c_output, load_ir_flag, optimize_bf_flag,
+                    store_size);
+  }
+
+  if (profile_output) {
+    return RunProfileMode(argv[optind], profile_output, load_ir_flag,
+                          store_size);
+  }
+
+  if (tape_report) {
+    return RunTapeMode(argv[optind], tape_report, load_ir_flag,
+                       optimize_bf_flag, store_size);
+  }
+
+  if (differential_flag) {
+    return RunDifferentialMode(argv[optind], store_size);
+  }
+
+  // The budget needs the context ABI, so budgeted -i runs go this way too
+  bool budget = max_steps > 0 || max_seconds > 0;
+  if (mapped_input || mapped_output || (interpret_flag && budget)) {
+    BFOptions options;
+    options.optimize_bf = optimize_bf_flag;
+    options.optimize_llvm = optimize_llvm_flag;
+    options.store_size = store_size;
+    options.count_steps = budget;
+    return RunMappedMode(argv[optind], mapped_input, mapped_output, options,
+                         max_steps, max_seconds);
+  }
+
+  if (parallel_flag) {
+    BFOptions options;
+    options.optimize_bf = optimize_bf_flag;
+    options.optimize_llvm = optimize_llvm_flag;
+    options.store_size = store_size;
+    return RunParallelMode(argv[optind], options, workers);
+  }
+
+  if (batch_inputs) {
+    BFOptions options;
+    options.optimize_bf = optimize_bf_flag;
+    options.optimize_llvm = optimize_llvm_flag;
+    options.store_size = store_size;
+    options.count_steps = budget;
+    return RunBatchMode(argv[optind], batch_inputs, options, workers,
+                        max_steps, max_seconds);
+  }
+
+  // Everything up to the call into generated code counts as compiling
+  std::unique_ptr<PerfCounters> counters;
+  PerfCounts compile_counts;
+  if (perf_stats_flag) {
+    counters.reset(new PerfCounters());
+    counters->Start();
+  }
+
   ifstream source_file(argv[optind]);
   std::unique_ptr<Module> module(new Module("bfcode", getGlobalContext()));
-  std::unique_ptr<ASTNode> prog(Parse(source_file));
+  std::unique_ptr<ASTNode> prog;
+  // Refers to nodes of the optimized program, which live until codegen
+  LoopProfile loop_profile;
+  std::map<CNode*, int> debug_lines;
   // This function belongs to the module
   Function* func;
+  CodeGenOptions codegen_options;
+  codegen_options.store_size = store_size;
+  codegen_options.outline_min_size = outline_min_size;
 
-  if (optimize_bf_flag) {
-    std::unique_ptr<CNode> canon_prog(TranslateASTToCanonIR(prog.get()));
-    canon_prog.reset(CanonicalizeBasicBlocks(canon_prog.get()));
-    canon_prog.reset(EliminateSimpleLoops(canon_prog.get()));
+  if (stream_flag) {
+    std::string error;
+    func = BuildProgramFromStream(source_file, module.get(), codegen_options,
+                                  optimize_bf_flag, &error);
+    if (!func) {
+      cerr << error << endl;
+      return -1;
+    }
+
+  } else if (optimize_bf_flag || load_ir_flag) {
+    std::unique_ptr<CNode> canon_prog(
+        ReadCanonProgram(argv[optind], load_ir_flag, true));
+    if (!canon_prog) {
+      return -1;
+    }
     if (print_flag) {
       PrintCanonIR(canon_prog.get());
+      PrintStaticPositions(canon_prog.get());
+    }
+    if (profile_input) {
+      std::string error;
+      if (!LoadLoopProfile(canon_prog.get(), profile_input, &loop_profile,
+                           &error)) {
+        cerr << error << endl;
+        return -1;
+      }
+      codegen_options.loop_profile = &loop_profile;
     }
-    func = BuildProgramFromCanon(canon_prog.get(), module.get(), store_size);
+    if (debug_flag) {
+      // Debuggers show the dump, since the optimized program no longer
+      // lines up with the source
+      codegen_options.debug_file =
+          "/tmp/bf-" + std::to_string(getpid()) + ".canon";
+      ofstream dump(codegen_options.debug_file);
+      PrintCanonIR(canon_prog.get(), dump, &debug_lines);
+      codegen_options.debug_lines = &debug_lines;
+    }
+    func = BuildProgramFromCanon(canon_prog.get(), module.get(),
+                                 codegen_options);
 
   } else {
+    prog.reset(Parse(source_file));
     if (print_flag) {
       std::unique_ptr<CNode> canon_prog(TranslateASTToCanonIR(prog.get()));
       PrintCanonIR(canon_prog.get());
     }
-    func = BuildProgramFromAST(prog.get(), module.get(), store_size);
+    func = BuildProgramFromAST(prog.get(), module.get(), codegen_options);
   }
 
   if (optimize_llvm_flag) {
-    FunctionPassManager pass_manager(module.get());
-    pass_manager.add(createVerifierPass());
-    pass_manager.add(new DataLayoutPass());
-    for (int repeat = 0; repeat < 5; repeat++) {
-      pass_manager.add(
-          createInstructionCombiningPass());  // Cleanup for scalarrepl.
-      pass_manager.add(createLICMPass());     // Hoist loop invariants
-      pass_manager.add(createLoopStrengthReducePass());  // Reduce strength
-      pass_manager.add(createIndVarSimplifyPass());      // Canonicalize indvars
-      pass_manager.add(createLoopDeletionPass());        // Delete dead loops
-      pass_manager.add(createGVNPass());                 // Remove redundancies
-      pass_manager.add(createSCCPPass());  // Constant prop with SCCP
-      pass_manager.add(createCFGSimplificationPass());  // Merge & remove BBs
-      pass_manager.add(createInstructionCombiningPass());
-      pass_manager.add(
-          createConstantPropagationPass());         // Propagate conditionals
-      pass_manager.add(createGVNPass());            // Remove redundancies
-      pass_manager.add(createAggressiveDCEPass());  // Delete dead instructions
-      pass_manager.add(createCFGSimplificationPass());     // Merge & remove BBs
-      pass_manager.add(createDeadStoreEliminationPass());  // Delete dead stores
-    }
-
-    pass_manager.doInitialization();
-    pass_manager.run(*func);
+    OptimizeLLVM(module.get(), func, profile_input != NULL);
   }
 
   if (output_flag) {
@@ -150,10 +857,14 @@ int main(int argc, char* argv[]) {
     InitializeNativeTargetAsmPrinter();
     InitializeNativeTargetAsmParser();
     std::string error;
+    // Owned by the engine
+    PerfMapMemoryManager* memory_manager = new PerfMapMemoryManager();
+    Module* jit_module = module.get();
     std::unique_ptr<ExecutionEngine> engine(
         EngineBuilder(std::move(module))
             .setErrorStr(&error)
-            .setMCJITMemoryManager(llvm::make_unique<SectionMemoryManager>())
+            .setMCJITMemoryManager(
+                std::unique_ptr<SectionMemoryManager>(memory_manager))
             .create());
     engine->finalizeObject();
 
@@ -161,9 +872,27 @@ int main(int argc, char* argv[]) {
       cout << "Engine not created: " << error << endl;
       return -1;
     }
+    if (debug_flag &&
+        !WritePerfMap(engine.get(), jit_module, memory_manager, &error)) {
+      cerr << error << endl;
+      return -1;
+    }
 
     void (*bf)() = (void (*)())engine->getPointerToFunction(func);
+    if (counters) {
+      compile_counts = counters->Stop();
+      counters->Start();
+    }
     bf();
+    if (counters) {
+      // Output still in stdio's buffer belongs to this phase
+      fflush(stdout);
+      PerfCounts execute_counts = counters->Stop();
+      PrintPerfCounts("compile", compile_counts, cerr);
+      PrintPerfCounts("execute", execute_counts, cerr);
+    }
+  } else if (counters) {
+    PrintPerfCounts("compile", counters->Stop(), cerr);
   }
   return 0;
 }
@@ -0,0 +1,77 @@
+#include <cstddef>
+#include <cstdio>
+#include <iterator>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mapped_io.h"
+
+MappedInput::MappedInput() {
+  data_ = nullptr;
+  size_ = 0;
+  mapped_ = false;
+}
+
+MappedInput::~MappedInput() {
+  if (mapped_) {
+    munmap(const_cast<char*>(data_), size_);
+  }
+}
+
+bool MappedInput::Open(const std::string& path, std::string* error) {
+  int fd = path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    *error = "Can't open " + path;
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      // Programs consume input front to back
+      madvise(data, st.st_size, MADV_SEQUENTIAL);
+      data_ = static_cast<const char*>(data);
+      size_ = st.st_size;
+      mapped_ = true;
+    }
+  }
+
+  bool ok = true;
+  if (!mapped_) {
+    char chunk[1 << 16];
+    ssize_t len;
+    while ((len = read(fd, chunk, sizeof(chunk))) > 0) {
+      buffer_.append(chunk, len);
+    }
+    if (len < 0) {
+      *error = "Can't read " + path;
+      ok = false;
+    }
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+  }
+
+  if (fd != STDIN_FILENO) {
+    close(fd);
+  }
+  return ok;
+}
+
+void WriteToFd(void* user, const char* data, size_t len) {
+  int fd = *static_cast<int*>(user);
+  while (len > 0) {
+    ssize_t written = write(fd, data, len);
+    if (written <= 0) {
+      return;
+    }
+    data += written;
+    len -= written;
+  }
+}
+
+int ReadFromStdin(void* user) { return getchar(); }
@@ -0,0 +1,35 @@
+#ifndef MAPPED_IO
+#define MAPPED_IO
+
+#include <cstddef>
+#include <string>
+
+// Input held in memory for a BFContext to read in place
+// Regular files are mapped rather than copied, so generated code reads
+// them straight from the page cache
+class MappedInput {
+ public:
+  MappedInput();
+  ~MappedInput();
+
+  // Maps path, or stdin for "-"
+  // Anything that can't be mapped, such as a pipe, is read into memory
+  // Returns false and sets error if it can't be read
+  bool Open(const std::string& path, std::string* error);
+  const char* GetData() { return data_; }
+  size_t GetSize() { return size_; }
+
+ private:
+  const char* data_;
+  size_t size_;
+  bool mapped_;
+  std::string buffer_;
+};
+
+// BFOutputSink that writes to the file descriptor pointed to by user
+void WriteToFd(void* user, const char* data, size_t len);
+
+// BFInputSource that reads stdin through stdio, ignoring user
+int ReadFromStdin(void* user);
+
+#endif  // MAPPED_IO
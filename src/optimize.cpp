@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <memory>
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/Passes.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/PassManager.h"
+#include "llvm/Transforms/Scalar.h"
+
+#include "canon_ir.h"
+#include "canonicalize_basic_blocks.h"
+#include "convert_counted_loops.h"
+#include "convert_if_loops.h"
+#include "eliminate_simple_loops.h"
+#include "optimize.h"
+#include "recognize_block_ops.h"
+#include "recognize_idioms.h"
+#include "sink_updates.h"
+
+using namespace llvm;
+
+// LLVM's loop, GVN and instcombine passes take time quadratic in loop
+// depth, so nests deeper than this, which only generated code reaches,
+// get just the passes that stay linear
+static const unsigned kMaxOptimizedLoopDepth = 64;
+
+static unsigned GetMaxLoopDepth(Function& func) {
+  DominatorTree dominators;
+  dominators.recalculate(func);
+  LoopInfoBase<BasicBlock, Loop> loops;
+  loops.Analyze(dominators);
+  unsigned depth = 0;
+  for (BasicBlock& block : func) {
+    depth = std::max(depth, loops.getLoopDepth(&block));
+  }
+  return depth;
+}
+
+CNode* OptimizeCanonIR(CNode* n) {
+  std::unique_ptr<CNode> prog(CanonicalizeBasicBlocks(n));
+  prog.reset(EliminateSimpleLoops(prog.get()));
+  prog.reset(RecognizeIdioms(prog.get()));
+  prog.reset(ConvertIfLoops(prog.get()));
+  prog.reset(ConvertCountedLoops(prog.get()));
+  prog.reset(SinkUpdates(prog.get()));
+  prog.reset(RecognizeBlockOps(prog.get()));
+  return prog.release();
+}
+
+void OptimizeLLVM(Module* module, Function* func, bool unroll) {
+  // Outlined loops come from the same program, so they nest no deeper
+  unsigned depth = 0;
+  for (Function& other : *module) {
+    if (!other.isDeclaration()) {
+      depth = std::max(depth, GetMaxLoopDepth(other));
+    }
+  }
+  bool deep = depth > kMaxOptimizedLoopDepth;
+
+  FunctionPassManager pass_manager(module);
+  pass_manager.add(createVerifierPass());
+  pass_manager.add(new DataLayoutPass());
+  pass_manager.add(createPromoteMemoryToRegisterPass());  // Promoted cells
+  pass_manager.add(createSROAPass());  // Split a statically addressed tape
+  if (deep) {
+    pass_manager.add(createSCCPPass());
+    pass_manager.add(createAggressiveDCEPass());
+    pass_manager.add(createCFGSimplificationPass());
+  }
+  if (unroll && !deep) {
+    pass_manager.add(createLoopUnrollPass());  // Per-loop profile hints
+  }
+  for (int repeat = 0; repeat < 5 && !deep; repeat++) {
+    pass_manager.add(
+        createInstructionCombiningPass());  // Cleanup for scalarrepl.
+    pass_manager.add(createLICMPass());     // Hoist loop invariants
+    pass_manager.add(createLoopStrengthReducePass());  // Reduce strength
+    pass_manager.add(createIndVarSimplifyPass());      // Canonicalize indvars
+    pass_manager.add(createLoopDeletionPass());        // Delete dead loops
+    pass_manager.add(createGVNPass());                 // Remove redundancies
+    pass_manager.add(createSCCPPass());  // Constant prop with SCCP
+    pass_manager.add(createCFGSimplificationPass());  // Merge & remove BBs
+    pass_manager.add(createInstructionCombiningPass());
+    pass_manager.add(
+        createConstantPropagationPass());         // Propagate conditionals
+    pass_manager.add(createGVNPass());            // Remove redundancies
+    pass_manager.add(createAggressiveDCEPass());  // Delete dead instructions
+    pass_manager.add(createCFGSimplificationPass());     // Merge & remove BBs
+    pass_manager.add(createDeadStoreEliminationPass());  // Delete dead stores
+  }
+
+  pass_manager.doInitialization();
+  pass_manager.run(*func);
+  // Loops outlined by the code generator
+  for (Function& other : *module) {
+    if (&other != func && !other.isDeclaration()) {
+      pass_manager.run(other);
+    }
+  }
+}
@@ -0,0 +1,21 @@
+#ifndef OPTIMIZE
+#define OPTIMIZE
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+
+#include "canon_ir.h"
+
+// Runs the BF-specific passes in order, returning a new program
+CNode* OptimizeCanonIR(CNode* n);
+
+// Runs the LLVM function pass pipeline over func, then over any other
+// functions defined in module
+// unroll adds loop unrolling, which follows the hints a loop profile
+// leaves in the code
+// Programs with loops nested more than 64 deep only get the passes whose
+// time is linear in the code size
+void OptimizeLLVM(llvm::Module* module, llvm::Function* func,
+                  bool unroll = false);
+
+#endif  // OPTIMIZE
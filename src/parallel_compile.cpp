@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/ExecutionEngine/MCJIT.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/TargetSelect.h"
+
+#include "canon_ir.h"
+#include "codegen_abi.h"
+#include "codegen_canon.h"
+#include "compact_ir.h"
+#include "optimize.h"
+#include "parallel_compile.h"
+
+using namespace llvm;
+
+// Regions are grown to at least this many instructions, so that tiny
+// top-level loops don't each pay for a module and an engine
+static const size_t kMinRegionSize = 1 << 12;
+
+CompiledRegion::CompiledRegion() { entry = nullptr; }
+
+CompiledRegion::~CompiledRegion() {}
+
+void RegionProgram::Run() {
+  std::vector<char> tape(store_size_);
+  char* ptr = tape.data();
+  for (CompiledRegion& region : regions_) {
+    ptr = region.entry(ptr);
+  }
+}
+
+// Everything here touches only the region's own context, which LLVM
+// allows to run alongside other contexts
+static void CompileRegion(const CompactProgram& code,
+                          const BFOptions& options, CompiledRegion* region) {
+  region->context.reset(new LLVMContext());
+  std::unique_ptr<Module> module(new Module("bfregion", *region->context));
+  CodeGenOptions codegen_options;
+  codegen_options.store_size = options.store_size;
+  codegen_options.abi = ABI_REGION;
+
+  std::unique_ptr<CNode> prog(DecodeCanonIR(code, 0, code.Size()));
+  if (options.optimize_bf) {
+    prog.reset(OptimizeCanonIR(prog.get()));
+  }
+  CNodeCodeGenVisitor visitor(module.get(), codegen_options);
+  visitor.CountLoops(prog.get());
+  prog->Accept(visitor);
+  IRBuilder<> builder = visitor.GetLastBuilder();
+  visitor.GetABI().EmitReturn(builder, visitor.GetPtr());
+  Function* func = visitor.GetMain();
+
+  if (options.optimize_llvm) {
+    OptimizeLLVM(module.get(), func);
+  }
+
+  std::string engine_error;
+  ExecutionEngine* engine =
+      EngineBuilder(std::move(module))
+          .setErrorStr(&engine_error)
+          .setMCJITMemoryManager(llvm::make_unique<SectionMemoryManager>())
+          .create();
+  if (!engine) {
+    region->error = "Engine not created: " + engine_error;
+    return;
+  }
+  // Machine code is generated here, on the worker
+  engine->finalizeObject();
+  region->engine.reset(engine);
+  region->entry = (char* (*)(char*))engine->getPointerToFunction(func);
+}
+
+static void CompileWorker(const std::vector<CompactProgram>& code,
+                          const BFOptions& options,
+                          std::vector<CompiledRegion>* regions,
+                          std::atomic<size_t>* next) {
+  for (size_t i = (*next)++; i < code.size(); i = (*next)++) {
+    CompileRegion(code[i], options, &(*regions)[i]);
+  }
+}
+
+RegionProgram* CompileRegions(std::istream& source, const BFOptions& options,
+                              unsigned workers, std::string* error) {
+  // The compact form is small enough to hold the whole program at once
+  std::vector<CompactProgram> code;
+  while (true) {
+    CompactProgram region;
+    size_t size;
+    do {
+      size = region.Size();
+      if (!ParseCompact(source, &region, error, kMinRegionSize)) {
+        return nullptr;
+      }
+    } while (region.Size() < kMinRegionSize && region.Size() > size);
+    if (region.Size() == 0) {
+      break;
+    }
+    code.push_back(std::move(region));
+  }
+
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  InitializeNativeTargetAsmParser();
+
+  std::unique_ptr<RegionProgram> program(new RegionProgram());
+  program->store_size_ = options.store_size;
+  // Regions can't be moved, so the vector is built at its final size
+  program->regions_ = std::vector<CompiledRegion>(code.size());
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> threads;
+  workers = std::max(1u, std::min<unsigned>(workers, code.size()));
+
+  for (unsigned i = 0; i < workers; i++) {
+    threads.emplace_back(CompileWorker, std::cref(code), std::cref(options),
+                         &program->regions_, &next);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (CompiledRegion& region : program->regions_) {
+    if (!region.entry) {
+      *error = region.error;
+      return nullptr;
+    }
+  }
+  return program.release();
+}
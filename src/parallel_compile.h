@@ -0,0 +1,53 @@
+#ifndef PARALLEL_COMPILE
+#define PARALLEL_COMPILE
+
+#include <istream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "libbf.h"
+
+namespace llvm {
+class ExecutionEngine;
+class LLVMContext;
+}
+
+// One piece of a program, compiled with ABI_REGION in a context of its
+// own so that regions can be optimized and lowered on different threads
+struct CompiledRegion {
+  CompiledRegion();
+  ~CompiledRegion();
+  // Declared first so that it outlives the engine
+  std::unique_ptr<llvm::LLVMContext> context;
+  std::unique_ptr<llvm::ExecutionEngine> engine;
+  char* (*entry)(char* ptr);
+  std::string error;
+};
+
+// A program split at top-level loops into separately compiled regions
+// Each region picks up the data pointer where the last one stopped
+class RegionProgram {
+ public:
+  // Runs every region in order on a fresh zeroed tape, with I/O through
+  // getchar and putchar
+  void Run();
+  size_t GetRegionCount() { return regions_.size(); }
+
+ private:
+  friend RegionProgram* CompileRegions(std::istream& source,
+                                       const BFOptions& options,
+                                       unsigned workers, std::string* error);
+  std::vector<CompiledRegion> regions_;
+  unsigned store_size_;
+};
+
+// Reads source into regions that end at top-level loops, then decodes,
+// optimizes and JIT-compiles them on a pool of workers
+// LLVM passes only ever see one region, so they run independently
+// Returns NULL and sets error if the loops are unbalanced or an engine
+// can't be created
+RegionProgram* CompileRegions(std::istream& source, const BFOptions& options,
+                              unsigned workers, std::string* error);
+
+#endif  // PARALLEL_COMPILE
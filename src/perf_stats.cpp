@@ -0,0 +1,142 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perf_stats.h"
+
+static const char* kEventNames[PERF_EVENT_COUNT] = {
+    "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses"};
+
+static uint64_t CacheMisses(uint64_t cache) {
+  return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+         (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+static int OpenEvent(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  // Kernel work, such as the I/O itself, shows up in the syscall counts
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+// Fills in the I/O fields from /proc/self/io, leaving them zero if it
+// can't be read
+static void ReadIOCounts(PerfCounts* counts) {
+  counts->read_bytes = counts->write_bytes = 0;
+  counts->read_calls = counts->write_calls = 0;
+  std::ifstream io("/proc/self/io");
+  std::string name;
+  uint64_t value;
+  while (io >> name >> value) {
+    if (name == "rchar:") {
+      counts->read_bytes = value;
+    } else if (name == "wchar:") {
+      counts->write_bytes = value;
+    } else if (name == "syscr:") {
+      counts->read_calls = value;
+    } else if (name == "syscw:") {
+      counts->write_calls = value;
+    }
+  }
+}
+
+static double Now() {
+  std::chrono::duration<double> now =
+      std::chrono::steady_clock::now().time_since_epoch();
+  return now.count();
+}
+
+PerfCounters::PerfCounters() {
+  fds_[PERF_CYCLES] =
+      OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  fds_[PERF_INSTRUCTIONS] =
+      OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  fds_[PERF_BRANCH_MISSES] =
+      OpenEvent(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+  fds_[PERF_L1D_MISSES] = OpenEvent(PERF_TYPE_HW_CACHE,
+                                    CacheMisses(PERF_COUNT_HW_CACHE_L1D));
+  fds_[PERF_LLC_MISSES] = OpenEvent(PERF_TYPE_HW_CACHE,
+                                    CacheMisses(PERF_COUNT_HW_CACHE_LL));
+}
+
+PerfCounters::~PerfCounters() {
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      close(fd);
+    }
+  }
+}
+
+void PerfCounters::Start() {
+  ReadIOCounts(&start_);
+  for (int fd : fds_) {
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  start_.seconds = Now();
+}
+
+PerfCounts PerfCounters::Stop() {
+  PerfCounts counts;
+  counts.seconds = Now() - start_.seconds;
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    counts.events[i] = 0;
+    counts.available[i] = fds_[i] >= 0;
+    if (counts.available[i]) {
+      ioctl(fds_[i], PERF_EVENT_IOC_DISABLE, 0);
+      counts.available[i] =
+          read(fds_[i], &counts.events[i], sizeof(uint64_t)) ==
+          sizeof(uint64_t);
+    }
+  }
+
+  ReadIOCounts(&counts);
+  counts.read_bytes -= start_.read_bytes;
+  counts.write_bytes -= start_.write_bytes;
+  counts.read_calls -= start_.read_calls;
+  counts.write_calls -= start_.write_calls;
+  return counts;
+}
+
+void PrintPerfCounts(const char* phase, const PerfCounts& counts,
+                     std::ostream& out) {
+  out << phase << ":" << std::endl;
+  out << std::fixed << std::setprecision(3);
+  out << "  " << std::setw(16) << counts.seconds * 1000 << "  ms" << std::endl;
+  for (int i = 0; i < PERF_EVENT_COUNT; i++) {
+    out << "  " << std::setw(16);
+    if (counts.available[i]) {
+      out << counts.events[i];
+    } else {
+      out << "n/a";
+    }
+    out << "  " << kEventNames[i] << std::endl;
+  }
+  if (counts.available[PERF_CYCLES] && counts.available[PERF_INSTRUCTIONS] &&
+      counts.events[PERF_CYCLES] > 0) {
+    out << "  " << std::setw(16)
+        << double(counts.events[PERF_INSTRUCTIONS]) /
+               counts.events[PERF_CYCLES]
+        << "  instructions per cycle" << std::endl;
+  }
+  out << "  " << std::setw(16) << counts.read_bytes << "  bytes read in "
+      << counts.read_calls << " syscalls" << std::endl;
+  out << "  " << std::setw(16) << counts.write_bytes << "  bytes written in "
+      << counts.write_calls << " syscalls" << std::endl;
+}
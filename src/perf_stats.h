@@ -0,0 +1,47 @@
+#ifndef PERF_STATS
+#define PERF_STATS
+
+#include <cstdint>
+#include <ostream>
+
+// Hardware events counted for a phase, in the order they are printed
+enum PerfEvent {
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_BRANCH_MISSES,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_EVENT_COUNT
+};
+
+// Counts for one phase of a run
+struct PerfCounts {
+  // False if the kernel refused the counter, e.g. in a VM or container
+  bool available[PERF_EVENT_COUNT];
+  uint64_t events[PERF_EVENT_COUNT];
+  // From /proc/self/io; includes stdio flushed during the phase
+  uint64_t read_bytes;
+  uint64_t write_bytes;
+  uint64_t read_calls;
+  uint64_t write_calls;
+  double seconds;
+};
+
+// Counts user-space events on the calling thread with perf_event_open,
+// between Start and Stop
+class PerfCounters {
+ public:
+  PerfCounters();
+  ~PerfCounters();
+  void Start();
+  PerfCounts Stop();
+
+ private:
+  int fds_[PERF_EVENT_COUNT];
+  PerfCounts start_;
+};
+
+void PrintPerfCounts(const char* phase, const PerfCounts& counts,
+                     std::ostream& out);
+
+#endif  // PERF_STATS
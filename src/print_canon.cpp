@@ -1,10 +1,14 @@
 #include <iostream>
+#include <map>
 #include <sstream>
 
 #include "canon_ir.h"
 #include "print_canon.h"
 
-CanonIRPRinterVisitor::CanonIRPRinterVisitor() { indent_level_ = 0; }
+CanonIRPRinterVisitor::CanonIRPRinterVisitor(std::ostream& out) : out_(out) {
+  indent_level_ = 0;
+  line_ = 0;
+}
 
 void CanonIRPRinterVisitor::VisitNextCNode(CNode* n) {
   CNode* next = n->GetNextCNode();
@@ -13,15 +17,16 @@ void CanonIRPRinterVisitor::VisitNextCNode(CNode* n) {
   }
 }
 
-void CanonIRPRinterVisitor::PrintWithIndent(const std::string& s) {
+void CanonIRPRinterVisitor::PrintWithIndent(CNode* n, const std::string& s) {
   for (int i = 0; i < indent_level_; i++) {
-    std::cerr << "  ";
+    out_ << "  ";
   }
-  std::cerr << s << std::endl;
+  out_ << s << std::endl;
+  lines_[n] = ++line_;
 }
 
 void CanonIRPRinterVisitor::Visit(CNode* n) {
-  PrintWithIndent("CNode");
+  PrintWithIndent(n, "CNode");
   VisitNextCNode(n);
 }
 
@@ -29,7 +34,7 @@ void CanonIRPRinterVisitor::Visit(CPtrMov* n) {
   int amt = n->GetAmt();
   std::stringstream ss;
   ss << "CPtrMov(" << amt << ")";
-  PrintWithIndent(ss.str());
+  PrintWithIndent(n, ss.str());
   VisitNextCNode(n);
 }
 
@@ -38,7 +43,7 @@ void CanonIRPRinterVisitor::Visit(CAdd* n) {
   int offset = n->GetOffset();
   std::stringstream ss;
   ss << "CAdd(" << offset << "," << amt << ")";
-  PrintWithIndent(ss.str());
+  PrintWithIndent(n, ss.str());
   VisitNextCNode(n);
 }
 
@@ -48,7 +53,7 @@ void CanonIRPRinterVisitor::Visit(CMul* n) {
   int target_offset = n->GetTargetOffset();
   std::stringstream ss;
   ss << "CMul(" << op_offset << "," << target_offset << "," << amt << ")";
-  PrintWithIndent(ss.str());
+  PrintWithIndent(n, ss.str());
   VisitNextCNode(n);
 }
 
@@ -57,7 +62,7 @@ void CanonIRPRinterVisitor::Visit(CSet* n) {
   int offset = n->GetOffset();
   std::stringstream ss;
   ss << "CSet(" << offset << "," << amt << ")";
-  PrintWithIndent(ss.str());
+  PrintWithIndent(n, ss.str());
   VisitNextCNode(n);
 }
 
@@ -65,7 +70,7 @@ void CanonIRPRinterVisitor::Visit(CInput* n) {
   int offset = n->GetOffset();
   std::stringstream ss;
   ss << "CInput(" << offset << ")";
-  PrintWithIndent(ss.str());
+  PrintWithIndent(n, ss.str());
   VisitNextCNode(n);
 }
 
@@ -73,21 +78,82 @@ void CanonIRPRinterVisitor::Visit(COutput* n) {
   int offset = n->GetOffset();
   std::stringstream ss;
   ss << "COutput(" << offset << ")";
-  PrintWithIndent(ss.str());
+  PrintWithIndent(n, ss.str());
   VisitNextCNode(n);
 }
 
 void CanonIRPRinterVisitor::Visit(CLoop* n) {
-  PrintWithIndent("CLoop:");
+  PrintWithIndent(n, "CLoop:");
+  indent_level_ += 1;
+  n->GetBody()->Accept(*this);
+  indent_level_ -= 1;
+  VisitNextCNode(n);
+}
+
+void CanonIRPRinterVisitor::Visit(CIf* n) {
+  PrintWithIndent(n, "CIf:");
+  indent_level_ += 1;
+  n->GetBody()->Accept(*this);
+  indent_level_ -= 1;
+  VisitNextCNode(n);
+}
+
+void CanonIRPRinterVisitor::Visit(CCountedLoop* n) {
+  std::stringstream ss;
+  ss << "CCountedLoop(" << n->GetStep() << "):";
+  PrintWithIndent(n, ss.str());
   indent_level_ += 1;
   n->GetBody()->Accept(*this);
   indent_level_ -= 1;
   VisitNextCNode(n);
 }
 
+void CanonIRPRinterVisitor::Visit(CDivMod* n) {
+  std::stringstream ss;
+  if (n->HasDivisorCell()) {
+    ss << "CDivMod(@" << n->GetDivisorOffset() << ","
+       << n->GetQuotientOffset() << "," << n->GetRemainderOffset() << ","
+       << n->GetTempOffset() << "," << n->GetSecondTempOffset() << "):";
+  } else {
+    ss << "CDivMod(" << n->GetDivisor() << "," << n->GetQuotientOffset()
+       << "," << n->GetRemainderOffset() << "," << n->GetTempOffset()
+       << "):";
+  }
+  PrintWithIndent(n, ss.str());
+  indent_level_ += 1;
+  n->GetBody()->Accept(*this);
+  indent_level_ -= 1;
+  VisitNextCNode(n);
+}
+
+void CanonIRPRinterVisitor::Visit(CSetRange* n) {
+  std::stringstream ss;
+  ss << "CSetRange(" << n->GetOffset() << "," << n->GetCount() << ","
+     << n->GetAmt() << ")";
+  PrintWithIndent(n, ss.str());
+  VisitNextCNode(n);
+}
+
+void CanonIRPRinterVisitor::Visit(CMoveRange* n) {
+  std::stringstream ss;
+  ss << "CMoveRange(" << n->GetOffset() << "," << n->GetCount() << ","
+     << n->GetDistance() << ")";
+  PrintWithIndent(n, ss.str());
+  VisitNextCNode(n);
+}
+
 void PrintCanonIR(CNode* n) {
   CanonIRPRinterVisitor visitor;
   if (n) {
     n->Accept(visitor);
   }
 }
+
+void PrintCanonIR(CNode* n, std::ostream& out,
+                  std::map<CNode*, int>* lines) {
+  CanonIRPRinterVisitor visitor(out);
+  if (n) {
+    n->Accept(visitor);
+  }
+  *lines = visitor.GetLines();
+}
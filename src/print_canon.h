@@ -2,12 +2,13 @@
 #define PRINT_CANON
 
 #include <iostream>
+#include <map>
 
 #include "canon_ir.h"
 
 class CanonIRPRinterVisitor : public CNodeVisitor {
  public:
-  CanonIRPRinterVisitor();
+  CanonIRPRinterVisitor(std::ostream& out = std::cerr);
   void Visit(CNode* n);
   void Visit(CPtrMov* n);
   void Visit(CAdd* n);
@@ -16,13 +17,27 @@ class CanonIRPRinterVisitor : public CNodeVisitor {
   void Visit(CInput* n);
   void Visit(COutput* n);
   void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  // The line, counting from 1, that each node was printed on
+  const std::map<CNode*, int>& GetLines() { return lines_; }
 
  private:
   void VisitNextCNode(CNode* n);
-  void PrintWithIndent(const std::string& s);
+  void PrintWithIndent(CNode* n, const std::string& s);
+  std::ostream& out_;
   int indent_level_;
+  int line_;
+  std::map<CNode*, int> lines_;
 };
 
+// Prints to stderr
 void PrintCanonIR(CNode* n);
+// Prints to out, recording the line of each node
+void PrintCanonIR(CNode* n, std::ostream& out, std::map<CNode*, int>* lines);
 
 #endif  // PRINT_CANON
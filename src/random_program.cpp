@@ -0,0 +1,130 @@
+#include <random>
+#include <string>
+
+#include "random_program.h"
+
+namespace {
+
+class ProgramGenerator {
+ public:
+  ProgramGenerator(std::mt19937& rng, const GeneratorOptions& options)
+      : rng_(rng), options_(options) {
+    position_ = options.width / 2;
+  }
+
+  std::string Generate() {
+    // Start mid-way so the program has room on both sides
+    std::string program(position_, '>');
+    while ((int)program.size() < options_.length) {
+      program += Block(0);
+    }
+    return program;
+  }
+
+ private:
+  int Random(int n) {
+    return std::uniform_int_distribution<int>(0, n - 1)(rng_);
+  }
+
+  std::string Repeat(char c, int n) { return std::string(n, c); }
+
+  // Moves to a random cell within the window, relative to the position
+  std::string MoveWithin(int* moved) {
+    int target = Random(options_.width);
+    *moved = target - position_;
+    position_ = target;
+    return *moved > 0 ? Repeat('>', *moved) : Repeat('<', -*moved);
+  }
+
+  // Returns to the cell the last MoveWithin started from
+  std::string MoveBack(int moved) {
+    position_ -= moved;
+    return moved > 0 ? Repeat('<', moved) : Repeat('>', -moved);
+  }
+
+  std::string Adds() {
+    int amt = Random(21) - 10;
+    return amt > 0 ? Repeat('+', amt) : Repeat('-', -amt);
+  }
+
+  // Commands with no net pointer movement
+  std::string Balanced(int depth) {
+    std::string code;
+    int statements = 1 + Random(4);
+    for (int i = 0; i < statements; i++) {
+      int moved;
+      code += MoveWithin(&moved);
+      if (depth < options_.max_depth && Random(4) == 0) {
+        code += Block(depth + 1);
+      } else {
+        code += Adds();
+        if (options_.allow_io && Random(6) == 0) {
+          code += Random(3) == 0 ? "," : ".";
+        }
+      }
+      code += MoveBack(moved);
+    }
+    return code;
+  }
+
+  std::string Block(int depth) {
+    int moved;
+    std::string code = MoveWithin(&moved);
+    switch (depth < options_.max_depth ? Random(9) : 0) {
+      case 0:
+        code += Adds();
+        break;
+      case 1:
+        // Clear
+        code += "[-]";
+        break;
+      case 2: {
+        // Multiply into other cells
+        std::string body = "-";
+        int targets = 1 + Random(3);
+        for (int i = 0; i < targets; i++) {
+          int out;
+          body += MoveWithin(&out) + Adds() + MoveBack(out);
+        }
+        code += "[" + body + "]";
+        break;
+      }
+      case 3:
+        // If block
+        code += "[" + Balanced(depth + 1) + "[-]]";
+        break;
+      case 4:
+        // Counted loop with a body the loop cell stays out of
+        code += "[" + Balanced(depth + 1) + Repeat('-', 1 + Random(3)) + "]";
+        break;
+      case 5:
+        // Halving: cell, flag, temp, quotient
+        code += "[->>+<[->->+<<]>[-<+>]<<]";
+        break;
+      case 6:
+        // Scan, after which the real position is no longer known
+        code += Random(2) == 0 ? "[>]" : "[<]";
+        break;
+      case 7:
+        // Arbitrary balanced loop, which may not terminate
+        code += "[" + Balanced(depth + 1) + "]";
+        break;
+      default:
+        code += Adds() + ".";
+        break;
+    }
+    return code + MoveBack(moved);
+  }
+
+  std::mt19937& rng_;
+  const GeneratorOptions& options_;
+  int position_;
+};
+
+}  // namespace
+
+std::string GenerateProgram(std::mt19937& rng,
+                            const GeneratorOptions& options) {
+  ProgramGenerator generator(rng, options);
+  return generator.Generate();
+}
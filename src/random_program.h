@@ -0,0 +1,25 @@
+#ifndef RANDOM_PROGRAM
+#define RANDOM_PROGRAM
+
+#include <random>
+#include <string>
+
+struct GeneratorOptions {
+  // Rough number of commands in the program
+  int length = 120;
+  int max_depth = 3;
+  // Cells the generated code stays within while its position is known
+  int width = 16;
+  bool allow_io = true;
+};
+
+// Generates a structured program for differential testing
+// Besides random commands it mixes in the loop shapes the optimizer
+// rewrites: clears, multiplications, if blocks, counted loops, the
+// halving idiom and scans
+// Programs may not terminate or may leave the tape; run them with a
+// step budget
+std::string GenerateProgram(std::mt19937& rng,
+                            const GeneratorOptions& options);
+
+#endif  // RANDOM_PROGRAM
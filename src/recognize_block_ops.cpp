@@ -0,0 +1,211 @@
+#include <cstdlib>
+#include <map>
+#include <stack>
+
+#include "canon_ir.h"
+#include "recognize_block_ops.h"
+
+static const int kCellModulus = 256;
+// Shorter runs are left to the vector lowering in codegen
+static const int kMinSetCells = 4;
+static const int kMinMoveCells = 4;
+
+static int Wrap(int amt) {
+  return ((amt % kCellModulus) + kCellModulus) % kCellModulus;
+}
+
+BlockOpVisitor::BlockOpVisitor() {
+  start_node_ = new CNode();
+  blocks_.push(start_node_);
+}
+
+void BlockOpVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  }
+}
+
+void BlockOpVisitor::AddSimpleStatement(CNode* n) {
+  CNode* block = blocks_.top();
+  block->SetNextCNode(n);
+  blocks_.top() = n;
+}
+
+CNode* BlockOpVisitor::VisitBody(CNode* body) {
+  CNode* body_node = new CNode();
+  blocks_.push(body_node);
+  body->Accept(*this);
+  blocks_.pop();
+  return body_node;
+}
+
+CNode* BlockOpVisitor::MatchMoveChain(CSet* set, int* offset, int* count,
+                                      int* distance) {
+  // t = 0, then for each source s next to t: t += s; s = 0; t = s
+  // Every target is empty when its move runs, so the adds are copies
+  if (Wrap(set->GetAmt()) != 0) {
+    return nullptr;
+  }
+  int target = set->GetOffset();
+  int step = 0;
+  int moves = 0;
+  CNode* last = set;
+  while (true) {
+    CMul* mul = dynamic_cast<CMul*>(last->GetNextCNode());
+    if (!mul || mul->GetTargetOffset() != target ||
+        Wrap(mul->GetAmt()) != 1) {
+      break;
+    }
+    int source = mul->GetOpOffset();
+    if (std::abs(target - source) != 1 ||
+        (step != 0 && target - source != step)) {
+      break;
+    }
+    CSet* clear = dynamic_cast<CSet*>(mul->GetNextCNode());
+    if (!clear || clear->GetOffset() != source ||
+        Wrap(clear->GetAmt()) != 0) {
+      break;
+    }
+    step = target - source;
+    moves++;
+    target = source;
+    last = clear;
+  }
+  if (moves < kMinMoveCells) {
+    return nullptr;
+  }
+
+  // target is now the last source, at the far end from the first
+  *offset = step > 0 ? target : set->GetOffset() - step;
+  *count = moves;
+  *distance = step;
+  return last;
+}
+
+CNode* BlockOpVisitor::EmitSetRun(CSet* first) {
+  // Sets don't read the tape, so a run of them can be written in any
+  // order, as long as a later set to the same cell still wins
+  std::map<int, int> values;
+  CNode* last = first;
+  for (CNode* n = first; n; n = n->GetNextCNode()) {
+    CSet* set = dynamic_cast<CSet*>(n);
+    int offset, count, distance;
+    if (!set ||
+        (n != first && MatchMoveChain(set, &offset, &count, &distance))) {
+      break;
+    }
+    values[set->GetOffset()] = Wrap(set->GetAmt());
+    last = n;
+  }
+
+  auto start = values.begin();
+  while (start != values.end()) {
+    auto end = start;
+    int count = 0;
+    while (end != values.end() && end->first == start->first + count &&
+           end->second == start->second) {
+      ++end;
+      count++;
+    }
+    if (count >= kMinSetCells) {
+      AddSimpleStatement(new CSetRange(start->first, count, start->second));
+    } else {
+      for (auto it = start; it != end; ++it) {
+        AddSimpleStatement(new CSet(it->first, it->second));
+      }
+    }
+    start = end;
+  }
+  return last;
+}
+
+void BlockOpVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void BlockOpVisitor::Visit(CPtrMov* n) {
+  AddSimpleStatement(new CPtrMov(n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void BlockOpVisitor::Visit(CAdd* n) {
+  AddSimpleStatement(new CAdd(n->GetOffset(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void BlockOpVisitor::Visit(CMul* n) {
+  AddSimpleStatement(
+      new CMul(n->GetOpOffset(), n->GetTargetOffset(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void BlockOpVisitor::Visit(CSet* n) {
+  int offset, count, distance;
+  CNode* last = MatchMoveChain(n, &offset, &count, &distance);
+  if (last) {
+    AddSimpleStatement(new CMoveRange(offset, count, distance));
+  } else {
+    last = EmitSetRun(n);
+  }
+  VisitNextCNode(last);
+}
+
+void BlockOpVisitor::Visit(CInput* n) {
+  AddSimpleStatement(new CInput(n->GetOffset()));
+  VisitNextCNode(n);
+}
+
+void BlockOpVisitor::Visit(COutput* n) {
+  AddSimpleStatement(new COutput(n->GetOffset()));
+  VisitNextCNode(n);
+}
+
+void BlockOpVisitor::Visit(CLoop* n) {
+  CLoop* loop = new CLoop();
+  loop->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(loop);
+  VisitNextCNode(n);
+}
+
+void BlockOpVisitor::Visit(CIf* n) {
+  CIf* if_node = new CIf();
+  if_node->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(if_node);
+  VisitNextCNode(n);
+}
+
+void BlockOpVisitor::Visit(CCountedLoop* n) {
+  CCountedLoop* loop = new CCountedLoop(n->GetStep());
+  loop->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(loop);
+  VisitNextCNode(n);
+}
+
+void BlockOpVisitor::Visit(CDivMod* n) {
+  CDivMod* div_mod =
+      new CDivMod(n->GetDivisor(), n->GetDivisorOffset(),
+                  n->GetQuotientOffset(), n->GetRemainderOffset(),
+                  n->GetTempOffset(), n->GetSecondTempOffset());
+  div_mod->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(div_mod);
+  VisitNextCNode(n);
+}
+
+void BlockOpVisitor::Visit(CSetRange* n) {
+  AddSimpleStatement(
+      new CSetRange(n->GetOffset(), n->GetCount(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void BlockOpVisitor::Visit(CMoveRange* n) {
+  AddSimpleStatement(
+      new CMoveRange(n->GetOffset(), n->GetCount(), n->GetDistance()));
+  VisitNextCNode(n);
+}
+
+CNode* RecognizeBlockOps(CNode* n) {
+  BlockOpVisitor visitor;
+  if (n) {
+    n->Accept(visitor);
+  }
+  return visitor.GetProgram();
+}
@@ -0,0 +1,46 @@
+#ifndef RECOGNIZE_BLOCK_OPS
+#define RECOGNIZE_BLOCK_OPS
+
+#include <stack>
+
+#include "canon_ir.h"
+
+// Rewrites runs of sets of one value to consecutive cells, like
+// [-]>[-]>[-] leaves, into CSetRanges, and chains of moves that shift a
+// block one cell over, like >[-]<[->+<]<[->+<] leaves, into CMoveRanges
+// Expects the order SinkUpdates leaves updates in
+class BlockOpVisitor : public CNodeVisitor {
+ public:
+  BlockOpVisitor();
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  CNode* GetProgram() { return start_node_; }
+
+ private:
+  void VisitNextCNode(CNode* n);
+  void AddSimpleStatement(CNode* n);
+  CNode* VisitBody(CNode* body);
+  // If a move chain starts at set, returns its last node and fills in
+  // the CMoveRange operands, otherwise returns nullptr
+  CNode* MatchMoveChain(CSet* set, int* offset, int* count, int* distance);
+  // Lowers the run of CSets starting at first, returning its last node
+  CNode* EmitSetRun(CSet* first);
+  std::stack<CNode*> blocks_;
+  CNode* start_node_;
+};
+
+CNode* RecognizeBlockOps(CNode* n);
+
+#endif  // RECOGNIZE_BLOCK_OPS
@@ -0,0 +1,413 @@
+#include <map>
+#include <set>
+#include <stack>
+#include <vector>
+
+#include "canon_ir.h"
+#include "recognize_idioms.h"
+
+static const int kCellModulus = 256;
+
+static int Wrap(int amt) {
+  return ((amt % kCellModulus) + kCellModulus) % kCellModulus;
+}
+
+static bool IsAffine(const AffineValue& value, int constant,
+                     const std::map<int, int>& coeffs) {
+  return value.constant == constant && value.coeffs == coeffs;
+}
+
+AffineSummaryVisitor::AffineSummaryVisitor(CNode* end) {
+  end_ = end;
+  straight_line_ = true;
+  ptr_mov_ = 0;
+}
+
+void AffineSummaryVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next && next != end_) {
+    next->Accept(*this);
+  }
+}
+
+AffineValue& AffineSummaryVisitor::GetCell(int offset) {
+  auto it = cells_.find(offset);
+  if (it == cells_.end()) {
+    // Untouched cells still hold their value from before the body
+    AffineValue value;
+    value.coeffs[offset] = 1;
+    it = cells_.insert(std::make_pair(offset, value)).first;
+  }
+  return it->second;
+}
+
+std::map<int, AffineValue> AffineSummaryVisitor::GetChangedCells() {
+  std::map<int, AffineValue> changed;
+  for (auto& pair : cells_) {
+    if (!IsAffine(pair.second, 0, {{pair.first, 1}})) {
+      changed.insert(pair);
+    }
+  }
+  return changed;
+}
+
+void AffineSummaryVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void AffineSummaryVisitor::Visit(CPtrMov* n) {
+  ptr_mov_ += n->GetAmt();
+  VisitNextCNode(n);
+}
+
+void AffineSummaryVisitor::Visit(CAdd* n) {
+  AffineValue& value = GetCell(ptr_mov_ + n->GetOffset());
+  value.constant = Wrap(value.constant + n->GetAmt());
+  VisitNextCNode(n);
+}
+
+void AffineSummaryVisitor::Visit(CMul* n) {
+  AffineValue op = GetCell(ptr_mov_ + n->GetOpOffset());
+  AffineValue& target = GetCell(ptr_mov_ + n->GetTargetOffset());
+  int amt = n->GetAmt();
+
+  target.constant = Wrap(target.constant + op.constant * amt);
+  for (auto& pair : op.coeffs) {
+    int coeff = Wrap(target.coeffs[pair.first] + pair.second * amt);
+    if (coeff == 0) {
+      target.coeffs.erase(pair.first);
+    } else {
+      target.coeffs[pair.first] = coeff;
+    }
+  }
+  VisitNextCNode(n);
+}
+
+void AffineSummaryVisitor::Visit(CSet* n) {
+  AffineValue value;
+  value.constant = Wrap(n->GetAmt());
+  cells_[ptr_mov_ + n->GetOffset()] = value;
+  VisitNextCNode(n);
+}
+
+void AffineSummaryVisitor::Visit(CInput* n) {
+  straight_line_ = false;
+  VisitNextCNode(n);
+}
+
+void AffineSummaryVisitor::Visit(COutput* n) {
+  straight_line_ = false;
+  VisitNextCNode(n);
+}
+
+void AffineSummaryVisitor::Visit(CLoop* n) {
+  straight_line_ = false;
+  VisitNextCNode(n);
+}
+
+void AffineSummaryVisitor::Visit(CIf* n) {
+  straight_line_ = false;
+  VisitNextCNode(n);
+}
+
+void AffineSummaryVisitor::Visit(CCountedLoop* n) {
+  straight_line_ = false;
+  VisitNextCNode(n);
+}
+
+void AffineSummaryVisitor::Visit(CDivMod* n) {
+  straight_line_ = false;
+  VisitNextCNode(n);
+}
+
+void AffineSummaryVisitor::Visit(CSetRange* n) {
+  AffineValue value;
+  value.constant = Wrap(n->GetAmt());
+  for (int i = 0; i < n->GetCount(); i++) {
+    cells_[ptr_mov_ + n->GetOffset() + i] = value;
+  }
+  VisitNextCNode(n);
+}
+
+void AffineSummaryVisitor::Visit(CMoveRange* n) {
+  int source = ptr_mov_ + n->GetOffset();
+  int target = source + n->GetDistance();
+  std::vector<AffineValue> moved;
+  for (int i = 0; i < n->GetCount(); i++) {
+    moved.push_back(GetCell(source + i));
+  }
+  for (int i = 0; i < n->GetCount(); i++) {
+    cells_[source + i] = AffineValue();
+  }
+  for (int i = 0; i < n->GetCount(); i++) {
+    cells_[target + i] = moved[i];
+  }
+  VisitNextCNode(n);
+}
+
+IdiomVisitor::IdiomVisitor() {
+  start_node_ = new CNode();
+  blocks_.push(start_node_);
+}
+
+void IdiomVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  }
+}
+
+void IdiomVisitor::AddSimpleStatement(CNode* n) {
+  CNode* block = blocks_.top();
+  block->SetNextCNode(n);
+  blocks_.top() = n;
+}
+
+CDivMod* IdiomVisitor::MatchDivMod(CNode* body) {
+  // Halving loop: each pass adds the flag f to the quotient q, then
+  // toggles f through the temporary t
+  //   q += f; f = t + 1 - f; t = 0; *ptr -= 1
+  // Starting from f = t = 0 this adds *ptr/2 to q and leaves *ptr%2 in f
+  AffineSummaryVisitor summary;
+  body->Accept(summary);
+  if (!summary.IsStraightLine() || summary.GetPtrMov() != 0) {
+    return nullptr;
+  }
+
+  std::map<int, AffineValue> cells = summary.GetChangedCells();
+  if (cells.size() != 4 || !IsAffine(cells[0], Wrap(-1), {{0, 1}})) {
+    return nullptr;
+  }
+
+  for (auto& t : cells) {
+    if (t.first == 0 || !IsAffine(t.second, 0, {})) {
+      continue;
+    }
+    for (auto& f : cells) {
+      if (f.first == 0 || f.first == t.first ||
+          !IsAffine(f.second, 1, {{f.first, Wrap(-1)}, {t.first, 1}})) {
+        continue;
+      }
+      for (auto& q : cells) {
+        if (q.first != 0 && q.first != t.first && q.first != f.first &&
+            IsAffine(q.second, 0, {{q.first, 1}, {f.first, 1}})) {
+          return new CDivMod(2, 0, q.first, f.first, t.first, t.first);
+        }
+      }
+    }
+  }
+  return nullptr;
+}
+
+CDivMod* IdiomVisitor::MatchCellDivMod(CNode* body) {
+  // Division by the divisor cell v, as in the usual divmod algorithm
+  //   [->-[>+>>]>[+[-<+>]>+>>]<<<<<]
+  // Each pass counts v down and the remainder r up; when v runs out, r
+  // goes back into it and the quotient goes up. The inner loops run at
+  // most once, picking a path by where they leave the pointer, so the
+  // cells they land on must be clear
+  CLoop* count_loop = nullptr;
+  CLoop* carry_loop = nullptr;
+  for (CNode* n = body->GetNextCNode(); n; n = n->GetNextCNode()) {
+    CLoop* loop = dynamic_cast<CLoop*>(n);
+    if (!loop) {
+      continue;
+    }
+    if (!count_loop) {
+      count_loop = loop;
+    } else if (!carry_loop) {
+      carry_loop = loop;
+    } else {
+      return nullptr;
+    }
+  }
+  if (!carry_loop) {
+    return nullptr;
+  }
+
+  // Decrements the dividend and v, ending on v
+  AffineSummaryVisitor head(count_loop);
+  body->Accept(head);
+  int v = head.GetPtrMov();
+  std::map<int, AffineValue> cells = head.GetChangedCells();
+  if (!head.IsStraightLine() || v == 0 || cells.size() != 2 ||
+      !IsAffine(cells[0], Wrap(-1), {{0, 1}}) ||
+      !IsAffine(cells[v], Wrap(-1), {{v, 1}})) {
+    return nullptr;
+  }
+
+  // While v is left, counts r up and jumps to the first landing cell
+  AffineSummaryVisitor count;
+  count_loop->GetBody()->Accept(count);
+  int jump = count.GetPtrMov();
+  cells = count.GetChangedCells();
+  if (!count.IsStraightLine() || jump == 0 || cells.size() != 1) {
+    return nullptr;
+  }
+  int r = cells.begin()->first;
+  if (r == 0 || !IsAffine(cells[r], 1, {{r, 1}})) {
+    return nullptr;
+  }
+
+  // Steps to r, or from the first landing cell to the second
+  AffineSummaryVisitor step(carry_loop);
+  count_loop->GetNextCNode()->Accept(step);
+  if (!step.IsStraightLine() || step.GetPtrMov() != r ||
+      !step.GetChangedCells().empty()) {
+    return nullptr;
+  }
+
+  // Once v runs out, moves r + 1 into it, bumps the quotient and jumps to
+  // the second landing cell
+  AffineSummaryVisitor carry;
+  carry_loop->GetBody()->Accept(carry);
+  cells = carry.GetChangedCells();
+  if (!carry.IsStraightLine() || carry.GetPtrMov() != jump ||
+      cells.size() != 3 || !IsAffine(cells[0], 0, {}) ||
+      !IsAffine(cells[-r], 1, {{-r, 1}, {0, 1}})) {
+    return nullptr;
+  }
+  int q = 0;
+  for (auto& pair : cells) {
+    if (pair.first != 0 && pair.first != -r) {
+      q = pair.first;
+    }
+  }
+  if (!IsAffine(cells[q], 1, {{q, 1}})) {
+    return nullptr;
+  }
+
+  // Returns to the dividend
+  AffineSummaryVisitor tail;
+  CNode* rest = carry_loop->GetNextCNode();
+  if (rest) {
+    rest->Accept(tail);
+  }
+  if (!tail.IsStraightLine() || !tail.GetChangedCells().empty() ||
+      v + r + jump + tail.GetPtrMov() != 0) {
+    return nullptr;
+  }
+
+  // Offsets from the dividend, which must all differ
+  std::set<int> offsets = {0, v, v + r, v + r + q, v + jump, v + r + jump};
+  if (offsets.size() != 6) {
+    return nullptr;
+  }
+  return new CDivMod(0, v, v + r + q, v + r, v + jump, v + r + jump);
+}
+
+void IdiomVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void IdiomVisitor::Visit(CPtrMov* n) {
+  AddSimpleStatement(new CPtrMov(n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void IdiomVisitor::Visit(CAdd* n) {
+  AddSimpleStatement(new CAdd(n->GetOffset(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void IdiomVisitor::Visit(CMul* n) {
+  AddSimpleStatement(
+      new CMul(n->GetOpOffset(), n->GetTargetOffset(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void IdiomVisitor::Visit(CSet* n) {
+  AddSimpleStatement(new CSet(n->GetOffset(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void IdiomVisitor::Visit(CInput* n) {
+  AddSimpleStatement(new CInput(n->GetOffset()));
+  VisitNextCNode(n);
+}
+
+void IdiomVisitor::Visit(COutput* n) {
+  AddSimpleStatement(new COutput(n->GetOffset()));
+  VisitNextCNode(n);
+}
+
+void IdiomVisitor::Visit(CLoop* n) {
+  CNode* body_node = new CNode();
+
+  blocks_.push(body_node);
+  n->GetBody()->Accept(*this);
+  blocks_.pop();
+
+  CDivMod* div_mod = MatchDivMod(body_node);
+  if (!div_mod) {
+    div_mod = MatchCellDivMod(body_node);
+  }
+  if (div_mod) {
+    // The loop stays behind as the fallback
+    div_mod->SetBody(body_node);
+    AddSimpleStatement(div_mod);
+  } else {
+    CLoop* loop = new CLoop();
+    loop->SetBody(body_node);
+    AddSimpleStatement(loop);
+  }
+  VisitNextCNode(n);
+}
+
+void IdiomVisitor::Visit(CIf* n) {
+  CNode* body_node = new CNode();
+
+  blocks_.push(body_node);
+  n->GetBody()->Accept(*this);
+  blocks_.pop();
+
+  CIf* if_node = new CIf();
+  if_node->SetBody(body_node);
+  AddSimpleStatement(if_node);
+  VisitNextCNode(n);
+}
+
+void IdiomVisitor::Visit(CCountedLoop* n) {
+  CNode* body_node = new CNode();
+
+  blocks_.push(body_node);
+  n->GetBody()->Accept(*this);
+  blocks_.pop();
+
+  CCountedLoop* loop = new CCountedLoop(n->GetStep());
+  loop->SetBody(body_node);
+  AddSimpleStatement(loop);
+  VisitNextCNode(n);
+}
+
+void IdiomVisitor::Visit(CDivMod* n) {
+  CNode* body_node = new CNode();
+
+  blocks_.push(body_node);
+  n->GetBody()->Accept(*this);
+  blocks_.pop();
+
+  CDivMod* div_mod =
+      new CDivMod(n->GetDivisor(), n->GetDivisorOffset(),
+                  n->GetQuotientOffset(), n->GetRemainderOffset(),
+                  n->GetTempOffset(), n->GetSecondTempOffset());
+  div_mod->SetBody(body_node);
+  AddSimpleStatement(div_mod);
+  VisitNextCNode(n);
+}
+
+void IdiomVisitor::Visit(CSetRange* n) {
+  AddSimpleStatement(
+      new CSetRange(n->GetOffset(), n->GetCount(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void IdiomVisitor::Visit(CMoveRange* n) {
+  AddSimpleStatement(
+      new CMoveRange(n->GetOffset(), n->GetCount(), n->GetDistance()));
+  VisitNextCNode(n);
+}
+
+CNode* RecognizeIdioms(CNode* n) {
+  IdiomVisitor visitor;
+  if (n) {
+    n->Accept(visitor);
+  }
+  return visitor.GetProgram();
+}
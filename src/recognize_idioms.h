@@ -0,0 +1,83 @@
+#ifndef RECOGNIZE_IDIOMS
+#define RECOGNIZE_IDIOMS
+
+#include <map>
+#include <stack>
+
+#include "canon_ir.h"
+
+// Value of a cell after a straight-line body, as a constant plus
+// multiples of cell values from before the body
+// Amounts are kept modulo the cell size
+struct AffineValue {
+  int constant = 0;
+  std::map<int, int> coeffs;
+};
+
+// Summarizes the effect of a body with no loops or I/O
+// Stops before end, if given, so that a body can be taken apart around
+// its loops
+class AffineSummaryVisitor : public CNodeVisitor {
+ public:
+  explicit AffineSummaryVisitor(CNode* end = nullptr);
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  bool IsStraightLine() { return straight_line_; }
+  int GetPtrMov() { return ptr_mov_; }
+  // Final values of the cells the body changes
+  std::map<int, AffineValue> GetChangedCells();
+
+ private:
+  void VisitNextCNode(CNode* n);
+  AffineValue& GetCell(int offset);
+  std::map<int, AffineValue> cells_;
+  CNode* end_;
+  bool straight_line_;
+  int ptr_mov_;
+};
+
+// Rewrites loops that implement known arithmetic idioms into nodes with
+// a closed form
+class IdiomVisitor : public CNodeVisitor {
+ public:
+  IdiomVisitor();
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  CNode* GetProgram() { return start_node_; }
+
+ private:
+  void VisitNextCNode(CNode* n);
+  void AddSimpleStatement(CNode* n);
+  CDivMod* MatchDivMod(CNode* body);
+  CDivMod* MatchCellDivMod(CNode* body);
+  std::stack<CNode*> blocks_;
+  CNode* start_node_;
+};
+
+CNode* RecognizeIdioms(CNode* n);
+
+#endif  // RECOGNIZE_IDIOMS
@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+
+#include "runtime.h"
+
+// With a time limit, the clock is read once per this many steps
+static const uint64_t kStepSlice = 1 << 20;
+// Without one, slices stop here, so that unchecked charges can take
+// steps below zero without wrapping
+static const uint64_t kMaxStepSlice = std::numeric_limits<int64_t>::max();
+
+static int64_t Now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+void InitContext(BFContext* ctx, char* tape, uint64_t tape_size,
+                 const char* input, uint64_t input_len, char* output,
+                 uint64_t output_len, BFOutputSink sink, void* user) {
+  ctx->tape = tape;
+  ctx->tape_size = tape_size;
+  ctx->input = input;
+  ctx->input_len = input_len;
+  ctx->input_pos = 0;
+  ctx->output = output;
+  ctx->output_len = output_len;
+  ctx->output_pos = 0;
+  ctx->sink = sink;
+  ctx->source = NULL;
+  ctx->user = user;
+  SetBudget(ctx, 0, 0);
+}
+
+void SetBudget(BFContext* ctx, uint64_t max_steps, double max_seconds) {
+  uint64_t total =
+      max_steps ? max_steps : std::numeric_limits<uint64_t>::max();
+  ctx->deadline = 0;
+  if (max_seconds > 0) {
+    ctx->deadline = Now() + (int64_t)(max_seconds * 1e9);
+  }
+  uint64_t slice = std::min(total, ctx->deadline ? kStepSlice : kMaxStepSlice);
+  ctx->steps = slice;
+  ctx->budget = total - slice;
+}
+
+void SetInputSource(BFContext* ctx, BFInputSource source) {
+  ctx->source = source;
+}
+
+void FlushContext(BFContext* ctx) {
+  if (ctx->output_pos > 0 && ctx->sink) {
+    ctx->sink(ctx->user, ctx->output, ctx->output_pos);
+  }
+  ctx->output_pos = 0;
+}
+
+extern "C" char bf_ctx_read(BFContext* ctx) {
+  if (!ctx->source) {
+    // Same value getchar() leaves in a cell at end of input
+    return (char)EOF;
+  }
+  FlushContext(ctx);
+  return (char)ctx->source(ctx->user);
+}
+
+extern "C" int bf_ctx_refill(BFContext* ctx, uint64_t amount) {
+  // Callers only get here with steps <= amount, and steps may be below
+  // zero after unchecked charges
+  uint64_t overdraft = amount - ctx->steps;
+  if (ctx->budget <= overdraft) {
+    ctx->steps = 0;
+    ctx->budget = 0;
+    return 0;
+  }
+  if (ctx->deadline && Now() >= ctx->deadline) {
+    return 0;
+  }
+  uint64_t left = ctx->budget - overdraft;
+  uint64_t slice = std::min(left, ctx->deadline ? kStepSlice : kMaxStepSlice);
+  ctx->steps = slice;
+  ctx->budget = left - slice;
+  return 1;
+}
+
+extern "C" void bf_ctx_write(BFContext* ctx, char c) {
+  FlushContext(ctx);
+  if (ctx->output_len == 0) {
+    if (ctx->sink) {
+      ctx->sink(ctx->user, &c, 1);
+    }
+    return;
+  }
+  ctx->output[ctx->output_pos++] = c;
+}
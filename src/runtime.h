@@ -0,0 +1,79 @@
+#ifndef RUNTIME
+#define RUNTIME
+
+#include <cstddef>
+#include <cstdint>
+
+// Receives output produced by a program run through a BFContext
+typedef void (*BFOutputSink)(void* user, const char* data, size_t len);
+// Supplies input once the input buffer runs out, returning the next byte
+// or EOF
+typedef int (*BFInputSource)(void* user);
+
+// Everything a program compiled with ABI_CONTEXT touches
+// Generated code reads and writes these fields directly, so the layout
+// must match the struct type built in codegen_abi.cpp
+struct BFContext {
+  // Zeroed tape owned by the caller
+  char* tape;
+  uint64_t tape_size;
+  // Input is read in place
+  const char* input;
+  uint64_t input_len;
+  uint64_t input_pos;
+  // Output is written here until full, then handed to the sink
+  char* output;
+  uint64_t output_len;
+  uint64_t output_pos;
+  // Loop back-edges left in the current slice, if counting
+  // Generated code charges steps and calls bf_ctx_refill once a back-edge
+  // would use up the slice; loops that can't run forever are charged
+  // without a check, so this goes below zero until the next back-edge
+  int64_t steps;
+  // Steps left after the current slice
+  uint64_t budget;
+  // steady_clock time in nanoseconds at which the run is stopped, checked
+  // between slices, or 0 for none
+  int64_t deadline;
+  BFOutputSink sink;
+  // NULL if the input buffer is all there is
+  BFInputSource source;
+  // Passed to sink and source
+  void* user;
+};
+
+// Returned by the entry point of an ABI_CONTEXT program
+// BF_OUT_OF_TAPE is only reported by the interpreter; compiled code does
+// not check the pointer
+// After BF_OUT_OF_STEPS the output so far is complete, but compiled code
+// may not have stored its latest cell values to the tape
+enum BFStatus { BF_OK = 0, BF_OUT_OF_STEPS = 1, BF_OUT_OF_TAPE = 2 };
+
+void InitContext(BFContext* ctx, char* tape, uint64_t tape_size,
+                 const char* input, uint64_t input_len, char* output,
+                 uint64_t output_len, BFOutputSink sink, void* user);
+
+// Stops the run after max_steps loop back-edges or max_seconds of wall
+// time, either 0 for no limit
+// The run stops at the first back-edge of a loop that could run forever
+// once the budget is used up, so loops that can't may overdraw it
+// Only counted if the program was compiled with count_steps
+void SetBudget(BFContext* ctx, uint64_t max_steps, double max_seconds);
+
+// Reads input from source after the input buffer, flushing output before
+// each read so that prompts appear before the program waits for a reply
+void SetInputSource(BFContext* ctx, BFInputSource source);
+
+// Hands buffered output to the sink
+void FlushContext(BFContext* ctx);
+
+// Slow paths called by generated code when the buffers run out
+extern "C" {
+char bf_ctx_read(BFContext* ctx);
+void bf_ctx_write(BFContext* ctx, char c);
+// Charges amount steps when the slice can't cover them, starting a new
+// slice; returns 0 once the budget or time is used up
+int bf_ctx_refill(BFContext* ctx, uint64_t amount);
+}
+
+#endif  // RUNTIME
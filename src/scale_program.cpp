@@ -0,0 +1,84 @@
+#include <string>
+
+#include "scale_program.h"
+
+// Loops of each kind the optimizer treats differently: a clear, a
+// multiply, a counted loop, a scan and a loop it leaves alone
+static const char* kSiblingLoops[] = {"[-]", "[->+++<]", "[--->+<]",
+                                      "[<]", "[->,<.]"};
+
+// A comment block holds no commands
+static const char kCommentText[] =
+    "This text only pads the source and the parser skips it ";
+static const size_t kCommentBlockSize = 4096;
+
+const char* GetScaleShapeName(ScaleShape shape) {
+  switch (shape) {
+    case SCALE_STRAIGHT_LINE:
+      return "straight";
+    case SCALE_NESTED_LOOPS:
+      return "nested";
+    case SCALE_NESTED_WALK:
+      return "walk";
+    case SCALE_SIBLING_LOOPS:
+      return "siblings";
+    case SCALE_COMMENTS:
+      return "comments";
+    default:
+      return "unknown";
+  }
+}
+
+std::string GenerateScaleProgram(ScaleShape shape, size_t size) {
+  std::string program;
+  program.reserve(size + kCommentBlockSize);
+  switch (shape) {
+    case SCALE_STRAIGHT_LINE:
+      // Drifts right so offsets keep growing, as in unrolled code
+      for (size_t i = 0; program.size() < size; i++) {
+        program += std::string(1 + i % 3, '+');
+        program += i % 4 == 3 ? "<" : ">";
+      }
+      break;
+    case SCALE_NESTED_LOOPS: {
+      size_t depth = size / 4;
+      for (size_t i = 0; i < depth; i++) {
+        program += "+[";
+      }
+      for (size_t i = 0; i < depth; i++) {
+        program += "-]";
+      }
+      break;
+    }
+    case SCALE_NESTED_WALK: {
+      size_t depth = size / 6;
+      for (size_t i = 0; i < depth; i++) {
+        program += "+[>";
+      }
+      for (size_t i = 0; i < depth; i++) {
+        program += "<-]";
+      }
+      break;
+    }
+    case SCALE_SIBLING_LOOPS:
+      for (size_t i = 0; program.size() < size; i++) {
+        program += "+>";
+        program += kSiblingLoops[i % (sizeof(kSiblingLoops) /
+                                      sizeof(kSiblingLoops[0]))];
+      }
+      break;
+    case SCALE_COMMENTS:
+      while (program.size() < size) {
+        program += "+>-<";
+        size_t end = program.size() + kCommentBlockSize;
+        while (program.size() < end) {
+          program += kCommentText;
+        }
+        program += "\n";
+      }
+      break;
+    default:
+      break;
+  }
+  return program;
+}
@@ -0,0 +1,28 @@
+#ifndef SCALE_PROGRAM
+#define SCALE_PROGRAM
+
+#include <string>
+
+// Program shapes that stress one dimension of the compiler each
+enum ScaleShape {
+  // One long run of updates and moves, with no loops
+  SCALE_STRAIGHT_LINE,
+  // Loops nested inside each other
+  SCALE_NESTED_LOOPS,
+  // Nested loops whose bodies each move one cell over, so each body
+  // reaches one cell further than the one inside it
+  SCALE_NESTED_WALK,
+  // Many small loops one after another, mixing idioms with plain loops
+  SCALE_SIBLING_LOOPS,
+  // A little code between large comment blocks
+  SCALE_COMMENTS,
+  SCALE_SHAPE_COUNT
+};
+
+const char* GetScaleShapeName(ScaleShape shape);
+
+// Generates a program of about size characters
+// Programs are only meant to be compiled; they need not terminate
+std::string GenerateScaleProgram(ScaleShape shape, size_t size);
+
+#endif  // SCALE_PROGRAM
@@ -0,0 +1,217 @@
+#include <map>
+#include <vector>
+
+#include "canon_ir.h"
+#include "cell_access.h"
+#include "sink_updates.h"
+
+static const int kCellModulus = 256;
+
+SinkUpdatesVisitor::SinkUpdatesVisitor(BodyAccessCache* access_cache) {
+  access_cache_ = access_cache;
+  start_node_ = new CNode();
+  last_node_ = start_node_;
+  ptr_mov_ = 0;
+}
+
+void SinkUpdatesVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  } else {
+    FlushAll();
+  }
+}
+
+void SinkUpdatesVisitor::AddSimpleStatement(CNode* n) {
+  last_node_->SetNextCNode(n);
+  last_node_ = n;
+}
+
+void SinkUpdatesVisitor::Flush(int offset) {
+  auto update = pending_.find(offset);
+  if (update == pending_.end()) {
+    return;
+  }
+  // Nothing has moved the pointer yet, so offsets need no adjusting
+  if (update->second.is_set) {
+    AddSimpleStatement(new CSet(offset, update->second.amt));
+  } else if (update->second.amt % kCellModulus != 0) {
+    AddSimpleStatement(new CAdd(offset, update->second.amt));
+  }
+  pending_.erase(update);
+}
+
+void SinkUpdatesVisitor::FlushAll() {
+  while (!pending_.empty()) {
+    Flush(pending_.begin()->first);
+  }
+  FlushPtrMov();
+}
+
+void SinkUpdatesVisitor::FlushPtrMov() {
+  if (ptr_mov_ == 0) {
+    return;
+  }
+  AddSimpleStatement(new CPtrMov(ptr_mov_));
+  std::map<int, PendingUpdate> rebased;
+  for (auto& pair : pending_) {
+    rebased[pair.first - ptr_mov_] = pair.second;
+  }
+  pending_.swap(rebased);
+  ptr_mov_ = 0;
+}
+
+void SinkUpdatesVisitor::FlushForNested(CNode* body,
+                                        const std::vector<int>& extra) {
+  const BodyAccess& access = GetBodyAccess(body, access_cache_);
+  if (!access.IsTracked()) {
+    // Nothing is known about the pointer or the cells afterwards
+    FlushAll();
+    return;
+  }
+
+  // The condition reads the current cell
+  Flush(ptr_mov_);
+  // There are usually far fewer pending updates than cells in the body
+  std::vector<int> read;
+  std::vector<int> written;
+  for (auto& pair : pending_) {
+    if (access.reads.count(pair.first - ptr_mov_)) {
+      read.push_back(pair.first);
+    } else if (access.writes.count(pair.first - ptr_mov_)) {
+      written.push_back(pair.first);
+    }
+  }
+  for (int offset : read) {
+    Flush(offset);
+  }
+  for (int offset : written) {
+    Flush(offset);
+  }
+  for (int offset : extra) {
+    Flush(ptr_mov_ + offset);
+  }
+  FlushPtrMov();
+}
+
+CNode* SinkUpdatesVisitor::VisitBody(CNode* body) {
+  SinkUpdatesVisitor nested(access_cache_);
+  body->Accept(nested);
+  return nested.GetProgram();
+}
+
+void SinkUpdatesVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void SinkUpdatesVisitor::Visit(CPtrMov* n) {
+  ptr_mov_ += n->GetAmt();
+  VisitNextCNode(n);
+}
+
+void SinkUpdatesVisitor::Visit(CAdd* n) {
+  pending_[ptr_mov_ + n->GetOffset()].amt += n->GetAmt();
+  VisitNextCNode(n);
+}
+
+void SinkUpdatesVisitor::Visit(CMul* n) {
+  int op = ptr_mov_ + n->GetOpOffset();
+  int target = ptr_mov_ + n->GetTargetOffset();
+  Flush(op);
+  // A pending addition to the target commutes with this one
+  auto update = pending_.find(target);
+  if (update != pending_.end() && update->second.is_set) {
+    Flush(target);
+  }
+  AddSimpleStatement(new CMul(op, target, n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void SinkUpdatesVisitor::Visit(CSet* n) {
+  PendingUpdate& update = pending_[ptr_mov_ + n->GetOffset()];
+  update.is_set = true;
+  update.amt = n->GetAmt();
+  VisitNextCNode(n);
+}
+
+void SinkUpdatesVisitor::Visit(CInput* n) {
+  // Input overwrites whatever was pending
+  int offset = ptr_mov_ + n->GetOffset();
+  pending_.erase(offset);
+  AddSimpleStatement(new CInput(offset));
+  VisitNextCNode(n);
+}
+
+void SinkUpdatesVisitor::Visit(COutput* n) {
+  int offset = ptr_mov_ + n->GetOffset();
+  Flush(offset);
+  AddSimpleStatement(new COutput(offset));
+  VisitNextCNode(n);
+}
+
+void SinkUpdatesVisitor::Visit(CLoop* n) {
+  FlushForNested(n->GetBody(), {});
+  CLoop* loop = new CLoop();
+  loop->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(loop);
+  VisitNextCNode(n);
+}
+
+void SinkUpdatesVisitor::Visit(CIf* n) {
+  FlushForNested(n->GetBody(), {});
+  CIf* if_node = new CIf();
+  if_node->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(if_node);
+  VisitNextCNode(n);
+}
+
+void SinkUpdatesVisitor::Visit(CCountedLoop* n) {
+  FlushForNested(n->GetBody(), {});
+  CCountedLoop* loop = new CCountedLoop(n->GetStep());
+  loop->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(loop);
+  VisitNextCNode(n);
+}
+
+void SinkUpdatesVisitor::Visit(CDivMod* n) {
+  FlushForNested(n->GetBody(),
+                 {n->GetDivisorOffset(), n->GetQuotientOffset(),
+                  n->GetRemainderOffset(), n->GetTempOffset(),
+                  n->GetSecondTempOffset()});
+  CDivMod* div_mod =
+      new CDivMod(n->GetDivisor(), n->GetDivisorOffset(),
+                  n->GetQuotientOffset(), n->GetRemainderOffset(),
+                  n->GetTempOffset(), n->GetSecondTempOffset());
+  div_mod->SetBody(VisitBody(n->GetBody()));
+  AddSimpleStatement(div_mod);
+  VisitNextCNode(n);
+}
+
+void SinkUpdatesVisitor::Visit(CSetRange* n) {
+  // The range overwrites whatever was pending in it
+  int offset = ptr_mov_ + n->GetOffset();
+  for (int i = 0; i < n->GetCount(); i++) {
+    pending_.erase(offset + i);
+  }
+  AddSimpleStatement(new CSetRange(offset, n->GetCount(), n->GetAmt()));
+  VisitNextCNode(n);
+}
+
+void SinkUpdatesVisitor::Visit(CMoveRange* n) {
+  int offset = ptr_mov_ + n->GetOffset();
+  for (int i = 0; i < n->GetCount(); i++) {
+    Flush(offset + i);
+    Flush(offset + n->GetDistance() + i);
+  }
+  AddSimpleStatement(
+      new CMoveRange(offset, n->GetCount(), n->GetDistance()));
+  VisitNextCNode(n);
+}
+
+CNode* SinkUpdates(CNode* n) {
+  BodyAccessCache access_cache;
+  SinkUpdatesVisitor visitor(&access_cache);
+  if (n) {
+    n->Accept(visitor);
+  }
+  return visitor.GetProgram();
+}
@@ -0,0 +1,65 @@
+#ifndef SINK_UPDATES
+#define SINK_UPDATES
+
+#include <map>
+#include <vector>
+
+#include "canon_ir.h"
+#include "cell_access.h"
+
+// Pending change to one cell
+struct PendingUpdate {
+  bool is_set = false;
+  int amt = 0;
+};
+
+// Carries CAdds, CSets and CPtrMovs forward past I/O, multiplies and
+// balanced loops that don't touch the same cells, merging them with
+// later updates
+// An update is only written out when something reads or overwrites its
+// cell, or at the end of its body
+// Nested bodies are summarized through access_cache, which the visitors
+// for the bodies inside share
+class SinkUpdatesVisitor : public CNodeVisitor {
+ public:
+  explicit SinkUpdatesVisitor(BodyAccessCache* access_cache);
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  CNode* GetProgram() { return start_node_; }
+
+ private:
+  void VisitNextCNode(CNode* n);
+  void AddSimpleStatement(CNode* n);
+  // Writes out the pending update to the cell at offset, if any
+  void Flush(int offset);
+  void FlushAll();
+  // Moves the pointer to where the pending updates expect it
+  void FlushPtrMov();
+  // Prepares for a node whose body runs at the current cell, keeping
+  // only the pending updates it provably leaves alone; extra lists cells
+  // the node touches outside its body
+  void FlushForNested(CNode* body, const std::vector<int>& extra);
+  CNode* VisitBody(CNode* body);
+  // Offsets are from the pointer at the start of the pending run
+  std::map<int, PendingUpdate> pending_;
+  BodyAccessCache* access_cache_;
+  int ptr_mov_;
+  CNode* last_node_;
+  CNode* start_node_;
+};
+
+CNode* SinkUpdates(CNode* n);
+
+#endif  // SINK_UPDATES
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <vector>
+
+#include "canon_ir.h"
+#include "cell_access.h"
+#include "static_position.h"
+
+StaticPositionVisitor::StaticPositionVisitor() {
+  is_static_ = true;
+  position_ = 0;
+}
+
+void StaticPositionVisitor::VisitNextCNode(CNode* n) {
+  CNode* next = n->GetNextCNode();
+  if (next) {
+    next->Accept(*this);
+  }
+}
+
+void StaticPositionVisitor::VisitLoop(CNode* body) {
+  LoopPosition loop;
+  loop.loop = loops_.size();
+  loop.is_static = is_static_;
+  loop.position = position_;
+  loops_.push_back(loop);
+
+  // A balanced body returns to the same cell on every pass
+  if (!GetBodyAccess(body, &access_cache_).IsBalanced()) {
+    is_static_ = false;
+  }
+
+  int entry_position = position_;
+  body->Accept(*this);
+  position_ = entry_position;
+}
+
+void StaticPositionVisitor::Visit(CNode* n) { VisitNextCNode(n); }
+
+void StaticPositionVisitor::Visit(CPtrMov* n) {
+  position_ += n->GetAmt();
+  VisitNextCNode(n);
+}
+
+void StaticPositionVisitor::Visit(CAdd* n) { VisitNextCNode(n); }
+
+void StaticPositionVisitor::Visit(CMul* n) { VisitNextCNode(n); }
+
+void StaticPositionVisitor::Visit(CSet* n) { VisitNextCNode(n); }
+
+void StaticPositionVisitor::Visit(CInput* n) { VisitNextCNode(n); }
+
+void StaticPositionVisitor::Visit(COutput* n) { VisitNextCNode(n); }
+
+void StaticPositionVisitor::Visit(CLoop* n) {
+  VisitLoop(n->GetBody());
+  VisitNextCNode(n);
+}
+
+void StaticPositionVisitor::Visit(CIf* n) {
+  VisitLoop(n->GetBody());
+  VisitNextCNode(n);
+}
+
+void StaticPositionVisitor::Visit(CCountedLoop* n) {
+  VisitLoop(n->GetBody());
+  VisitNextCNode(n);
+}
+
+void StaticPositionVisitor::Visit(CDivMod* n) {
+  VisitLoop(n->GetBody());
+  VisitNextCNode(n);
+}
+
+void StaticPositionVisitor::Visit(CSetRange* n) { VisitNextCNode(n); }
+
+void StaticPositionVisitor::Visit(CMoveRange* n) { VisitNextCNode(n); }
+
+void PrintStaticPositions(CNode* n) {
+  StaticPositionVisitor visitor;
+  if (n) {
+    n->Accept(visitor);
+  }
+
+  const std::vector<LoopPosition>& loops = visitor.GetLoops();
+  int static_loops = 0;
+  for (const LoopPosition& loop : loops) {
+    if (loop.is_static) {
+      static_loops++;
+    }
+  }
+  std::cerr << "Static pointer position in " << static_loops << " of "
+            << loops.size() << " loops" << std::endl;
+  for (const LoopPosition& loop : loops) {
+    if (loop.is_static) {
+      std::cerr << "  loop " << loop.loop << " at cell " << loop.position
+                << std::endl;
+    }
+  }
+}
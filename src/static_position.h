@@ -0,0 +1,50 @@
+#ifndef STATIC_POSITION
+#define STATIC_POSITION
+
+#include <vector>
+
+#include "canon_ir.h"
+#include "cell_access.h"
+
+// Where a loop starts, numbered in program order
+struct LoopPosition {
+  int loop;
+  bool is_static;
+  // Offset from the start of the tape, if static
+  int position;
+};
+
+// Finds the loops whose pointer position is a compile-time constant,
+// which holds until the first loop with an unbalanced body
+class StaticPositionVisitor : public CNodeVisitor {
+ public:
+  StaticPositionVisitor();
+  void Visit(CNode* n);
+  void Visit(CPtrMov* n);
+  void Visit(CAdd* n);
+  void Visit(CMul* n);
+  void Visit(CSet* n);
+  void Visit(CInput* n);
+  void Visit(COutput* n);
+  void Visit(CLoop* n);
+  void Visit(CIf* n);
+  void Visit(CCountedLoop* n);
+  void Visit(CDivMod* n);
+  void Visit(CSetRange* n);
+  void Visit(CMoveRange* n);
+
+  const std::vector<LoopPosition>& GetLoops() { return loops_; }
+
+ private:
+  void VisitNextCNode(CNode* n);
+  void VisitLoop(CNode* body);
+  std::vector<LoopPosition> loops_;
+  BodyAccessCache access_cache_;
+  bool is_static_;
+  int position_;
+};
+
+// Prints to stderr which loops are addressed from the tape start
+void PrintStaticPositions(CNode* n);
+
+#endif  // STATIC_POSITION
@@ -0,0 +1,45 @@
+#include <memory>
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+
+#include "canon_ir.h"
+#include "codegen_canon.h"
+#include "compact_ir.h"
+#include "optimize.h"
+#include "stream_compile.h"
+
+using namespace llvm;
+
+// Top-level instructions read per chunk when there are no loops to
+// split at
+static const size_t kStreamChunkSize = 1 << 16;
+
+Function* BuildProgramFromStream(std::istream& source, Module* module,
+                                 const CodeGenOptions& options,
+                                 bool optimize_bf, std::string* error) {
+  // The visitor keeps the pointer and position across chunks
+  CNodeCodeGenVisitor visitor(module, options);
+  CompactProgram chunk;
+  while (true) {
+    chunk.Clear();
+    if (!ParseCompact(source, &chunk, error, kStreamChunkSize)) {
+      return NULL;
+    }
+    if (chunk.Size() == 0) {
+      break;
+    }
+
+    std::unique_ptr<CNode> prog(DecodeCanonIR(chunk, 0, chunk.Size()));
+    if (optimize_bf) {
+      prog.reset(OptimizeCanonIR(prog.get()));
+    }
+    visitor.CountLoops(prog.get());
+    prog->Accept(visitor);
+  }
+
+  IRBuilder<> builder = visitor.GetLastBuilder();
+  visitor.GetABI().EmitReturn(builder);
+  return visitor.GetMain();
+}
@@ -0,0 +1,26 @@
+#ifndef STREAM_COMPILE
+#define STREAM_COMPILE
+
+#include <istream>
+#include <string>
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+
+#include "codegen_abi.h"
+
+// Compiles source a chunk at a time, each ending at a top-level loop
+// boundary: a chunk is read into the compact IR, decoded, optimized if
+// optimize_bf is set, emitted, and freed before the next one is read
+// Only SinkUpdates looks across a top-level loop, carrying pending cell
+// updates past loops that leave those cells alone; a chunk flushes them
+// at its end instead, so splitting costs folding them into the code after
+// the loop, and folding straight-line code across a chunk that hit the
+// size cap
+// Returns NULL and sets error if the loops are unbalanced
+llvm::Function* BuildProgramFromStream(std::istream& source,
+                                       llvm::Module* module,
+                                       const CodeGenOptions& options,
+                                       bool optimize_bf, std::string* error);
+
+#endif  // STREAM_COMPILE
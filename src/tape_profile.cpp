@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "tape_profile.h"
+
+void RecordCellAccess(TapeProfile* profile, uint64_t cell, int access) {
+  if (cell >= profile->reads.size()) {
+    profile->reads.resize(cell + 1);
+    profile->writes.resize(cell + 1);
+  }
+  if (access & CELL_READ) {
+    profile->reads[cell]++;
+  }
+  if (access & CELL_WRITE) {
+    profile->writes[cell]++;
+  }
+}
+
+bool SaveTapeReport(const TapeProfile& profile, const std::string& path,
+                    std::string* error) {
+  std::ofstream out(path);
+  if (!out) {
+    *error = "Can't write " + path;
+    return false;
+  }
+
+  size_t cells = profile.reads.size();
+  size_t first = cells;
+  size_t last = 0;
+  size_t touched = 0;
+  uint64_t reads = 0;
+  uint64_t writes = 0;
+  for (size_t i = 0; i < cells; i++) {
+    if (profile.reads[i] == 0 && profile.writes[i] == 0) {
+      continue;
+    }
+    first = std::min(first, i);
+    last = i;
+    touched++;
+    reads += profile.reads[i];
+    writes += profile.writes[i];
+  }
+
+  out << "pointer " << profile.min_ptr << ".." << profile.max_ptr
+      << std::endl;
+  if (touched == 0) {
+    out << "cells none" << std::endl;
+    return true;
+  }
+  out << "cells " << first << ".." << last << ", " << touched << " touched"
+      << std::endl;
+  out << "tape " << last + 1 << std::endl;
+  out << "accesses " << reads << " reads " << writes << " writes"
+      << std::endl;
+
+  // first[-last] reads writes, for each run of equal counts
+  size_t start = first;
+  for (size_t i = first + 1; i <= last + 1; i++) {
+    if (i <= last && profile.reads[i] == profile.reads[start] &&
+        profile.writes[i] == profile.writes[start]) {
+      continue;
+    }
+    if (profile.reads[start] != 0 || profile.writes[start] != 0) {
+      out << start;
+      if (i - 1 > start) {
+        out << "-" << i - 1;
+      }
+      out << " " << profile.reads[start] << " " << profile.writes[start]
+          << std::endl;
+    }
+    start = i;
+  }
+  return true;
+}
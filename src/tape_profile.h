@@ -0,0 +1,31 @@
+#ifndef TAPE_PROFILE
+#define TAPE_PROFILE
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// How an instruction uses a cell, as a bit mask
+enum CellAccess { CELL_READ = 1, CELL_WRITE = 2 };
+
+// Exact counts of the tape accesses made by one run
+struct TapeProfile {
+  // Furthest the data pointer got on either side of the first cell
+  int64_t min_ptr = 0;
+  int64_t max_ptr = 0;
+  // Accesses to each cell, indexed by cell; cells past the end were never
+  // touched
+  std::vector<uint64_t> reads;
+  std::vector<uint64_t> writes;
+};
+
+// Counts one access to cell, which must be on the tape
+void RecordCellAccess(TapeProfile* profile, uint64_t cell, int access);
+
+// Writes the pointer extent, the range of touched cells, the smallest
+// tape that holds them, and per-cell counts, with runs of cells that
+// have the same counts on one line
+bool SaveTapeReport(const TapeProfile& profile, const std::string& path,
+                    std::string* error);
+
+#endif  // TAPE_PROFILE